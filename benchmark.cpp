@@ -0,0 +1,420 @@
+#include "quicklog_posix.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * @file benchmark.cpp
+ *
+ * @brief Producer latency and server throughput benchmarks.
+ *
+ * Times every log() call with the #QUICKLOG_TIMESTAMP() tick counter and reports the
+ * p50, p99, p99.9 and maximum in nanoseconds, for various arguments, numbers of
+ * producers, logger sizes and wait strategies. Latency producers log in short bursts
+ * the server can keep up with, so the numbers are for log() itself, with Block only
+ * kicking in when a logger is too small. Throughput producers log as fast as they can,
+ * and the time includes the server printing everything.
+ *
+ * Compile with @code {.sh}
+ * g++ -Wall -std=c++14 -O2 benchmark.cpp -o benchmark -pthread
+ * @endcode
+ *
+ * Usage: @code{.sh}
+ * ./benchmark [-n ENTRIES] [GROUP ...]
+ * @endcode
+ * Runs every group unless some are named: args, producers, loggers, waits, throughput.
+ * Each producer logs ENTRIES entries, 200000 by default.
+ *
+ */
+
+using quicklog::detail::readTicks;
+
+
+/**
+ * @brief Histogram with buckets a 32nd of a power of two wide, like HdrHistogram, so
+ * percentiles are within about 3% however far apart the values are.
+ */
+class Histogram{
+public:
+    void record(uint64_t v){
+        ++m_counts[index(v)];
+        ++m_total;
+        if(v > m_max){
+            m_max = v;
+        }
+    }
+
+    void add(const Histogram & other){
+        for(size_t i=0; i<numBuckets; i++){
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        if(other.m_max > m_max){
+            m_max = other.m_max;
+        }
+    }
+
+    /** @brief The highest value in the bucket reached by fraction p of the values. */
+    uint64_t percentile(double p) const{
+        const uint64_t rank = static_cast<uint64_t>(p * m_total + 0.5);
+        uint64_t seen = 0;
+        for(size_t i=0; i<numBuckets; i++){
+            seen += m_counts[i];
+            if(seen >= rank && seen){
+                const uint64_t highest = lowest(i + 1) - 1;
+                return highest < m_max ? highest : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t max() const{
+        return m_max;
+    }
+
+private:
+    static constexpr unsigned subBits = 5;
+    static constexpr size_t subBuckets = size_t(1) << subBits;
+    static constexpr size_t numBuckets = (64 - subBits + 1) * subBuckets;
+
+    static size_t index(uint64_t v){
+        if(v < subBuckets){
+            return static_cast<size_t>(v);
+        }
+        const unsigned shift = 63 - __builtin_clzll(v) - subBits;
+        return (shift + 1) * subBuckets + static_cast<size_t>((v >> shift) & (subBuckets - 1));
+    }
+
+    static uint64_t lowest(size_t i){
+        if(i < subBuckets){
+            return i;
+        }
+        const unsigned shift = static_cast<unsigned>(i / subBuckets - 1);
+        return (subBuckets + i % subBuckets) << shift;
+    }
+
+    uint64_t m_counts[numBuckets] = {};
+    uint64_t m_total = 0;
+    uint64_t m_max = 0;
+};
+
+
+/** @brief Buffered sink that only counts what it's given. */
+struct CountingSink{
+    static constexpr bool buffered = true;
+
+    void write(const char *, size_t size){
+        bytes += size;
+    }
+
+    size_t bytes = 0;
+};
+
+
+/** @brief PlatformImpl that polls flat out between yields. */
+struct YieldWait{
+    void wait(){
+        std::this_thread::yield();
+    }
+
+    void notify(){}
+};
+
+
+/** @brief new that honours alignas(64) in C++14. */
+template<class T>
+static T * create(){
+    void *p = nullptr;
+    if(posix_memalign(&p, alignof(T), sizeof(T)) != 0){
+        QUICKLOG_ERROR("posix_memalign failed");
+    }
+    return new(p) T;
+}
+
+template<class T>
+static void destroy(T *t){
+    t->~T();
+    free(t);
+}
+
+
+static double g_nsPerTick = 1;
+static size_t g_entries = 200000;
+
+constexpr size_t warmup = 1000;
+constexpr size_t burst = 16;
+constexpr uint64_t burstGapNs = 20000;
+
+
+static void calibrate(){
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t startTicks = readTicks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const uint64_t ticks = readTicks() - startTicks;
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    g_nsPerTick = ns / static_cast<double>(ticks);
+}
+
+static double toNs(uint64_t ticks){
+    return static_cast<double>(ticks) * g_nsPerTick;
+}
+
+static void printHeader(const char *group){
+    printf("\n%-44s %8s %8s %8s %10s\n", group, "p50 ns", "p99", "p99.9", "max");
+}
+
+static void printLatency(const char *name, const Histogram & h){
+    printf("%-44s %8.0f %8.0f %8.0f %10.0f\n", name, toNs(h.percentile(0.5)), toNs(h.percentile(0.99)),
+           toNs(h.percentile(0.999)), toNs(h.max()));
+    fflush(stdout);
+}
+
+
+/**
+ * @brief One LogServer with its own Platform, Logger and Sink types, run for one
+ * measurement.
+ */
+template<class Platform, class Logger, class Sink = CountingSink>
+class Bench{
+public:
+    typedef quicklog::LogServer<16, Platform, Sink> Server;
+
+    /**
+     * @brief Time each logOne(logger, i) on producers threads.
+     *
+     * @return The latencies of all of them, in ticks.
+     */
+    template<class F>
+    static Histogram latency(size_t producers, F logOne){
+        Histogram total;
+        run(producers, [&](Logger & logger, Histogram & h){
+            const uint64_t gapTicks = static_cast<uint64_t>(burstGapNs / g_nsPerTick);
+            for(size_t i=0; i<g_entries + warmup; ){
+                for(size_t j=0; j<burst; j++, i++){
+                    const uint64_t before = readTicks();
+                    logOne(logger, i);
+                    const uint64_t after = readTicks();
+                    if(i >= warmup){
+                        h.record(after - before);
+                    }
+                }
+                // let the server catch up, as it would between bursts of real work.
+                const uint64_t until = readTicks() + gapTicks;
+                while(static_cast<int64_t>(readTicks() - until) < 0){
+                    quicklog::detail::cpuRelax();
+                }
+            }
+        }, total);
+        return total;
+    }
+
+    /**
+     * @brief Log as fast as possible on producers threads.
+     *
+     * @return entries per second, including the time the server takes to print them all.
+     */
+    template<class F>
+    static double throughput(size_t producers, F logOne, size_t & bytes){
+        Histogram unused;
+        const auto start = std::chrono::steady_clock::now();
+        bytes = run(producers, [&](Logger & logger, Histogram &){
+            for(size_t i=0; i<g_entries; i++){
+                logOne(logger, i);
+            }
+        }, unused);
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return static_cast<double>(producers * g_entries) / s;
+    }
+
+private:
+    /** @return the bytes the server wrote. */
+    template<class Body>
+    static size_t run(size_t producers, Body body, Histogram & total){
+        Server *server = create<Server>();
+        std::thread serverThread(server->process, server);
+        std::vector<Histogram> histograms(producers);
+        std::atomic<size_t> ready{0};
+        std::vector<std::thread> threads;
+        for(size_t t=0; t<producers; t++){
+            threads.emplace_back([&, t]{
+                Logger *logger = create<Logger>();
+                server->addLogger(*logger);
+                ++ready;
+                while(ready.load() < producers){}
+                body(*logger, histograms[t]);
+                logger->flush();
+                // waits for the server to print everything.
+                server->removeLogger(*logger);
+                destroy(logger);
+            });
+        }
+        for(size_t t=0; t<producers; t++){
+            threads[t].join();
+            total.add(histograms[t]);
+        }
+        server->shutdown();
+        serverThread.join();
+        const size_t bytes = server->sink().bytes;
+        destroy(server);
+        return bytes;
+    }
+};
+
+
+typedef quicklog::LocalLogger<8, 16 * 1024, quicklog::MaxAlign, quicklog::Block> DefaultLogger;
+
+// the arguments most groups log.
+static auto fourInts = [](auto & logger, size_t i){
+    logger.log(QUICKLOG_FMT("%d %d %d %zu\n"), 1, 2, 3, i);
+};
+
+
+static void timerOverhead(){
+    Histogram h;
+    for(size_t i=0; i<g_entries; i++){
+        const uint64_t before = readTicks();
+        const uint64_t after = readTicks();
+        h.record(after - before);
+    }
+    printLatency("timer overhead (included below)", h);
+}
+
+
+// for str() and bytes().
+static const char text[257] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+
+static void args(){
+    typedef Bench<quicklog::AdaptiveWait, DefaultLogger> B;
+    int local = 0;
+    printHeader("args (1 producer, LocalLogger<8, 16K>)");
+    timerOverhead();
+    printLatency("no arguments", B::latency(1, [](auto & logger, size_t){
+        logger.log(QUICKLOG_FMT("nothing\n"));
+    }));
+    printLatency("size_t", B::latency(1, [](auto & logger, size_t i){
+        logger.log(QUICKLOG_FMT("%zu\n"), i);
+    }));
+    printLatency("int, int, int, size_t", B::latency(1, fourInts));
+    printLatency("8 mixed (ints, doubles, char, pointer)", B::latency(1, [&](auto & logger, size_t i){
+        logger.log(QUICKLOG_FMT("%d %u %ld %zu %f %f %c %p\n"), 1, 2u, 3l, i, 0.5, 1.5 * i, 'x',
+                   static_cast<void*>(&local));
+    }));
+    printLatency("const char* and size_t", B::latency(1, [](auto & logger, size_t i){
+        logger.log(QUICKLOG_FMT("%s %zu\n"), "literal", i);
+    }));
+    printLatency("str() 16 bytes", B::latency(1, [](auto & logger, size_t i){
+        logger.log(QUICKLOG_FMT("%s %zu\n"), quicklog::str(text, 16), i);
+    }));
+    printLatency("str() 256 bytes", B::latency(1, [](auto & logger, size_t i){
+        logger.log(QUICKLOG_FMT("%s %zu\n"), quicklog::str(text, 256), i);
+    }));
+    printLatency("bytes() 64 bytes", B::latency(1, [](auto & logger, size_t i){
+        logger.log(QUICKLOG_FMT("%s %zu\n"), quicklog::bytes(text, 64), i);
+    }));
+    printLatency("QUICKLOG with a level, 4 ints", B::latency(1, [](auto & logger, size_t i){
+        QUICKLOG(logger, quicklog::Level::info, "%d %d %d %zu\n", 1, 2, 3, i);
+    }));
+    printLatency("unchecked format string, 4 ints", B::latency(1, [](auto & logger, size_t i){
+        logger.log("%d %d %d %zu\n", 1, 2, 3, i);
+    }));
+}
+
+
+static void producers(){
+    typedef Bench<quicklog::AdaptiveWait, DefaultLogger> B;
+    printHeader("producers (4 ints, LocalLogger<8, 16K>)");
+    const unsigned cpus = std::thread::hardware_concurrency();
+    for(size_t n : {1, 2, 4, 8, 16}){
+        if(n > 1 && n >= cpus){
+            break;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "producers: %zu", n);
+        printLatency(name, B::latency(n, fourInts));
+    }
+}
+
+
+static void loggers(){
+    printHeader("loggers (4 ints, 4 producers)");
+    printLatency("LocalLogger<2, 1K>",
+        Bench<quicklog::AdaptiveWait, quicklog::LocalLogger<2, 1024, quicklog::MaxAlign, quicklog::Block>>::latency(4, fourInts));
+    printLatency("LocalLogger<4, 4K>",
+        Bench<quicklog::AdaptiveWait, quicklog::LocalLogger<4, 4096, quicklog::MaxAlign, quicklog::Block>>::latency(4, fourInts));
+    printLatency("LocalLogger<8, 16K>", Bench<quicklog::AdaptiveWait, DefaultLogger>::latency(4, fourInts));
+    printLatency("LocalLogger<32, 64K>",
+        Bench<quicklog::AdaptiveWait, quicklog::LocalLogger<32, 64 * 1024, quicklog::MaxAlign, quicklog::Block>>::latency(4, fourInts));
+    printLatency("LocalLogger<8, 16K, NaturalAlign>",
+        Bench<quicklog::AdaptiveWait, quicklog::LocalLogger<8, 16 * 1024, quicklog::NaturalAlign, quicklog::Block>>::latency(4, fourInts));
+    printLatency("RingLocalLogger<64K>",
+        Bench<quicklog::AdaptiveWait, quicklog::RingLocalLogger<64 * 1024, quicklog::MaxAlign, quicklog::Block>>::latency(4, fourInts));
+    printLatency("RingLocalLogger<1M>",
+        Bench<quicklog::AdaptiveWait, quicklog::RingLocalLogger<1024 * 1024, quicklog::MaxAlign, quicklog::Block>>::latency(4, fourInts));
+}
+
+
+static void waits(){
+    printHeader("waits (4 ints, 4 producers, LocalLogger<8, 16K>)");
+    printLatency("AdaptiveWait", Bench<quicklog::AdaptiveWait, DefaultLogger>::latency(4, fourInts));
+    printLatency("TimedPoll<1 ms>", Bench<quicklog::TimedPoll<1000000>, DefaultLogger>::latency(4, fourInts));
+    printLatency("TimedPoll<100 us>", Bench<quicklog::TimedPoll<100000>, DefaultLogger>::latency(4, fourInts));
+    printLatency("yield", Bench<YieldWait, DefaultLogger>::latency(4, fourInts));
+}
+
+
+template<class Sink>
+static void printThroughput(const char *name, size_t producers){
+    size_t bytes;
+    const double rate = Bench<quicklog::AdaptiveWait, DefaultLogger, Sink>::throughput(producers, fourInts, bytes);
+    const double seconds = static_cast<double>(producers * g_entries) / rate;
+    printf("%-44s %8.2f %8.0f\n", name, rate / 1e6, static_cast<double>(bytes) / seconds / 1e6);
+    fflush(stdout);
+}
+
+static void throughput(){
+    printf("\n%-44s %8s %8s\n", "throughput (4 ints, LocalLogger<8, 16K>)", "M/s", "MB/s");
+    printThroughput<CountingSink>("formatted, 1 producer", 1);
+    printThroughput<CountingSink>("formatted, 4 producers", 4);
+    printThroughput<quicklog::BinarySink<CountingSink>>("binary, 1 producer", 1);
+    printThroughput<quicklog::BinarySink<CountingSink>>("binary, 4 producers", 4);
+}
+
+
+int main(int argc, char **argv){
+    struct Group{
+        const char *name;
+        void (*run)();
+    };
+    static const Group groups[] = {
+        {"args", args},
+        {"producers", producers},
+        {"loggers", loggers},
+        {"waits", waits},
+        {"throughput", throughput},
+    };
+
+    std::vector<const char*> selected;
+    for(int i=1; i<argc; i++){
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+            g_entries = strtoul(argv[++i], nullptr, 10);
+        }else{
+            selected.push_back(argv[i]);
+        }
+    }
+
+    calibrate();
+    for(const Group & group : groups){
+        bool run = selected.empty();
+        for(const char *name : selected){
+            run |= strcmp(name, group.name) == 0;
+        }
+        if(run){
+            group.run();
+        }
+    }
+}
@@ -1,6 +1,5 @@
 #include "quicklog.h"
 #include <thread>
-#include <mutex>
 #include <array>
 #include <time.h>
 
@@ -50,24 +49,6 @@ public:
     void notify(){
 
     }
-
-    /**
-     * @brief  A PlatformImpl should contain a mutex. Lock that mutex.
-     * 
-     */
-    void lock(){
-        mutex.lock();
-    }
-
-    /**
-     * @brief  A PlatformImpl should contain a mutex. Unlock that mutex.
-     * 
-     */
-    void unlock(){
-        mutex.unlock();
-    }
-private:
-    std::mutex mutex;
 };
 
 
@@ -138,12 +119,12 @@ private:
 
 
 
-    std::array<LogProducer, 4>  producers{
-        LogProducer("a"),
-        LogProducer("b"),
-        LogProducer("c"),
-        LogProducer("d"),   
-    };
+    std::array<LogProducer, 4>  producers{{
+        {"a"},
+        {"b"},
+        {"c"},
+        {"d"},
+    }};
 
 
 int main(){
@@ -7,10 +7,23 @@
  * 
  */
 
+#include <cstdio>
 #include <cstring>
 #include <cstdint>
 #include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <new>
 #include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
 
 
 
@@ -42,6 +55,24 @@
  */
 #ifndef QUICKLOG_PRINT
 #define QUICKLOG_PRINT(...) printf(__VA_ARGS__)
+#define QUICKLOG_DEFAULT_PRINT
+#endif
+
+
+/**
+ * @def QUICKLOG_FORMAT(buffer, size, ...)
+ */
+/**
+ * @brief Formats the original arguments to LocalLogger::log() into a char buffer
+ * of the given size, like snprintf. Used instead of #QUICKLOG_PRINT by LogServer
+ * sinks other than PrintSink.
+ * 
+ * Defaults to snprintf if #QUICKLOG_PRINT isn't defined, otherwise it must be defined
+ * to use those sinks.
+ * 
+ */
+#if !defined(QUICKLOG_FORMAT) && defined(QUICKLOG_DEFAULT_PRINT)
+#define QUICKLOG_FORMAT(buffer, size, ...) snprintf(buffer, size, __VA_ARGS__)
 #endif
 
 
@@ -65,360 +96,4842 @@
 #define QUICKLOG_ALIGN (alignof(std::max_align_t))
 
 
+/**
+ * @def QUICKLOG_FMT(fmt)
+ */
+/**
+ * @brief Wrap a printf format string literal so that LocalLogger::log() checks it against
+ * the rest of its arguments at compile time.
+ * 
+ * \code{.cpp}
+ * logger.log(QUICKLOG_FMT("%s n: %d\n"), name, i);
+ * \endcode
+ * 
+ * A conversion that doesn't match its argument, or the wrong number of arguments, is a
+ * compile error. Positional arguments, %n and wide characters aren't supported.
+ * The format string isn't stored in the log entry, and buffered LogServer sinks format
+ * it with a plan parsed at compile time rather than via #QUICKLOG_FORMAT.
+ * 
+ * Equivalent to #QUICKLOG_SITE at Level::info.
+ */
+#define QUICKLOG_FMT(fmt) QUICKLOG_SITE(quicklog::Level::info, fmt)
 
-#define QUICKLOG_MEMORY_FENCE asm volatile ("" : : : "memory")
 
 /**
- * @brief main namespace
+ * @def QUICKLOG_SITE(lvl, fmt)
+ */
+/**
+ * @brief Like #QUICKLOG_FMT, but also records the call site's level, lvl.
  * 
+ * Each use creates a distinct type describing the call site, which is registered with
+ * its format, file, line, level and argument types the first time it's logged. The
+ * record only holds the site's 16 bit ID (its decoder index) and the arguments.
  */
-namespace quicklog{
+#define QUICKLOG_SITE(lvl, fmt) ([]{ \
+        struct QuicklogSite : quicklog::detail::FormatString{ \
+            static constexpr const char * str(){ return fmt; } \
+            static constexpr const char * file(){ return __FILE__; } \
+            static constexpr unsigned line(){ return __LINE__; } \
+            static constexpr quicklog::Level level(){ return (lvl); } \
+        }; \
+        return QuicklogSite{}; \
+    }())
 
 
 /**
- * @brief Private implementation details.
+ * @def QUICKLOG(logger, level, fmt, ...)
+ */
+/**
+ * @brief Log a compile-time checked printf style message from a registered call site.
+ * 
+ * \code{.cpp}
+ * QUICKLOG(m_logger, quicklog::Level::warning, "%s took %d us\n", name, micros);
+ * \endcode
  * 
+ * fmt must be a string literal. See #QUICKLOG_SITE. Calls below #QUICKLOG_MIN_LEVEL compile
+ * to nothing, without evaluating their arguments.
  */
-namespace detail {
+#define QUICKLOG(logger, level, ...) \
+    (quicklog::detail::compiledIn(level) ? \
+        quicklog::detail::logAtSite(std::integral_constant<bool, quicklog::detail::compiledIn(level)>(), (logger), \
+            QUICKLOG_SITE(level, QUICKLOG_FIRST_(__VA_ARGS__, unused)), __VA_ARGS__) : \
+        (void)0)
 
-    class LogServerBase{
-    public:
-        virtual void _onDumpAvail() = 0;
-    };
+#define QUICKLOG_FIRST_(first, ...) first
 
-    class LocalLoggerBase{
-    public:
-	    virtual bool dump() = 0;
-    };
 
-    class LogEntryBase{
-    public:
-        size_t size;
-        LogEntryBase(size_t size) : size(size){}
+/**
+ * @def QUICKLOG_EVERY_N(logger, level, n, fmt, ...)
+ */
+/**
+ * @brief #QUICKLOG that only logs the first of every n calls from this call site.
+ * 
+ * \code{.cpp}
+ * QUICKLOG_EVERY_N(m_logger, quicklog::Level::debug, 1000, "queue depth %zu\n", depth);
+ * \endcode
+ * 
+ * Like the other limited forms, each thread keeps its own count for each call site, so
+ * the check needs no synchronization, and the arguments are only evaluated for calls that
+ * are logged. Calls while the site's level is turned off aren't counted.
+ */
+#define QUICKLOG_EVERY_N(logger, level, n, ...) \
+    QUICKLOG_LIMITED_(logger, level, quicklog::detail::EveryN, (n), __VA_ARGS__)
 
-        virtual void printSelf() = 0;
-    };
 
+/**
+ * @def QUICKLOG_RATE_LIMITED(logger, level, perSecond, fmt, ...)
+ */
+/**
+ * @brief #QUICKLOG that logs at most perSecond entries a second from this call site in each
+ * thread, in bursts of up to perSecond.
+ * 
+ * A token bucket timed with #QUICKLOG_TIMESTAMP(). Once a second at most, the first entry
+ * logged after some were suppressed is preceded by a #QUICKLOG_SUPPRESSED entry saying how many.
+ */
+#define QUICKLOG_RATE_LIMITED(logger, level, perSecond, ...) \
+    QUICKLOG_LIMITED_(logger, level, quicklog::detail::RateLimit, (perSecond), __VA_ARGS__)
 
-    /**
-     * @brief Special purpose semaphore implementation.
-     * 
-     * This isn't a normal semaphore. It only works if only one thread is allowed to
-     * call put() and only one thread is allowed to call get()/peek(). It relies only on the atomicity
-     * uint8_t reads and writes, and is therefor independent of platform or available libraries.
-     * 
-     */
-    class semaphore{
-    public:
-        void put(){
-            numPuts++;
-        }
 
-        /**
-         * @brief
-         * 
-         * @return uint8_t Current semaphore count.
-         */
-        uint8_t peek(){
-            return numPuts-numGets;
-        }
+/**
+ * @def QUICKLOG_FIRST_N(logger, level, n, fmt, ...)
+ */
+/**
+ * @brief #QUICKLOG that logs the first n calls from this call site in each thread, then
+ * only a #QUICKLOG_SUPPRESSED entry, at most once a second, while it's still being called.
+ */
+#define QUICKLOG_FIRST_N(logger, level, n, ...) \
+    QUICKLOG_LIMITED_(logger, level, quicklog::detail::FirstN, (n), __VA_ARGS__)
 
-        /** 
-         * @brief Decrement semaphore count. Assume peek was called already and
-         * decrement without checking.
-         */
-        void get(){
-            if(numPuts == numGets){
-                QUICKLOG_ERROR("get called on non-gettable semaphore.\n");
-            }
-            ++numGets;
-        }
+#define QUICKLOG_LIMITED_(logger, level, Limiter, limit, ...) \
+    (quicklog::detail::compiledIn(level) ? \
+        quicklog::detail::logLimited<Limiter>(std::integral_constant<bool, quicklog::detail::compiledIn(level)>(), \
+            (logger), QUICKLOG_SITE(level, QUICKLOG_FIRST_(__VA_ARGS__, unused)), (limit), \
+            [&](auto site){ quicklog::detail::logAtSite(std::true_type(), (logger), site, __VA_ARGS__); }) : \
+        (void)0)
 
-    private:
-        volatile uint8_t numPuts = 0;
-        volatile uint8_t numGets = 0;
-    };
 
+/**
+ * @def QUICKLOG_MIN_LEVEL
+ */
+/**
+ * @brief The lowest quicklog::Level compiled in. #QUICKLOG calls at lower levels are removed,
+ * and LocalLogger::log() discards #QUICKLOG_SITE entries below it. Either a Level or its
+ * integer value, e.g. -DQUICKLOG_MIN_LEVEL=2 for Level::info.
+ * 
+ * Defaults to Level::trace, so everything is compiled in. Levels that are compiled in can
+ * still be turned off at runtime per logger, see LevelFilter::setLevel().
+ */
+#ifndef QUICKLOG_MIN_LEVEL
+#define QUICKLOG_MIN_LEVEL quicklog::Level::trace
+#endif
 
-    template<typename Tuple, size_t ... I>
-    auto callPrintFunc(Tuple t, std::index_sequence<I ...>){
-        return QUICKLOG_PRINT(std::get<I>(t) ...);
-    }
 
+/**
+ * @def QUICKLOG_DROPPED(n)
+ */
+/**
+ * @brief Arguments of the entry a LocalLogger logs once it has room again after
+ * dropping entries. n is the number of entries dropped, as an unsigned long.
+ * Defaults to
+ * \code{.cpp}
+ * "quicklog: dropped %lu entries\n", (n)
+ * \endcode
+ */
+#ifndef QUICKLOG_DROPPED
+#define QUICKLOG_DROPPED(n) "quicklog: dropped %lu entries\n", (n)
+#endif
 
-    template<typename Tuple>
-    auto callPrintFunc(Tuple t){
-        constexpr auto size = std::tuple_size<Tuple>::value;
-        return callPrintFunc(t, std::make_index_sequence<size>{});
-    }
 
+/**
+ * @def QUICKLOG_SUPPRESSED(n, file, line)
+ */
+/**
+ * @brief Arguments of the entry a #QUICKLOG_RATE_LIMITED or #QUICKLOG_FIRST_N call site logs
+ * after suppressing entries. n is the number suppressed, as an unsigned long, and file and
+ * line are the call site's. Defaults to
+ * \code{.cpp}
+ * "quicklog: suppressed %lu entries from %s:%u\n", (n), (file), (line)
+ * \endcode
+ */
+#ifndef QUICKLOG_SUPPRESSED
+#define QUICKLOG_SUPPRESSED(n, file, line) "quicklog: suppressed %lu entries from %s:%u\n", (n), (file), (line)
+#endif
 
-    /**
-     * @brief Round sz up to size required for alignment.
-     * 
-     * @param sz 
-     * @return constexpr size_t 
-     */
-    constexpr size_t alignedSize(size_t sz){
-        if(sz % QUICKLOG_ALIGN){
-            sz += (QUICKLOG_ALIGN - sz % QUICKLOG_ALIGN);
-        }
-        return sz;
-    }
+
+/**
+ * @def QUICKLOG_MAX_ENTRY_TYPES
+ */
+/**
+ * @brief Maximum number of distinct argument type lists that can be passed to
+ * LocalLogger::log(). Each one takes a slot in the decoder table.
+ * 
+ * Every #QUICKLOG, #QUICKLOG_SITE and #QUICKLOG_FMT call site is a type list of its own.
+ * Logging one more calls #QUICKLOG_ERROR. If that returns, entries of the new types share
+ * one last slot, and are never printed.
+ * 
+ * Defaults to 4096.
+ */
+#ifndef QUICKLOG_MAX_ENTRY_TYPES
+#define QUICKLOG_MAX_ENTRY_TYPES 4096
+#endif
 
 
 
-    template<typename ... Ts>
-    class LogEntry : public LogEntryBase{
-    public:
-        std::tuple<Ts ...> values;
+/**
+ * @def QUICKLOG_CACHE_LINE
+ */
+/**
+ * @brief Alignment used to keep state written by producer and server threads on
+ * separate cache lines. Defaults to 64.
+ */
+#ifndef QUICKLOG_CACHE_LINE
+#define QUICKLOG_CACHE_LINE 64
+#endif
 
-        LogEntry() : LogEntryBase(0) {}
 
-        LogEntry(Ts ... args) : LogEntryBase(sizeof(*this))
-                                                , values(std::make_tuple(args ...))
-        {}
+/**
+ * @def QUICKLOG_MAX_COPY
+ */
+/**
+ * @brief Maximum number of bytes quicklog::str() and quicklog::bytes() copy into a log
+ * entry. Longer strings and byte ranges are truncated. Defaults to 255.
+ */
+#ifndef QUICKLOG_MAX_COPY
+#define QUICKLOG_MAX_COPY 255
+#endif
 
-        virtual void printSelf(){
-            callPrintFunc(values);
-        }
-    };
 
+/**
+ * @def QUICKLOG_MAX_TEXT
+ */
+/**
+ * @brief Maximum number of characters a quicklog::serializer formats a value into. Longer
+ * text is truncated. Defaults to 255.
+ */
+#ifndef QUICKLOG_MAX_TEXT
+#define QUICKLOG_MAX_TEXT 255
+#endif
 
-    template <size_t size>
-    class EntryBuffer{
-    public:
 
-        template<typename ...Ts>
-        bool pushEntry(const Ts ... vs){
-            constexpr size_t align_sz = alignedSize(sizeof(LogEntry<Ts ...>));
+/**
+ * @def QUICKLOG_TIMESTAMPS
+ */
+/**
+ * @brief Define as 1 to timestamp every entry when it's logged.
+ * 
+ * Each record then holds a #QUICKLOG_TIMESTAMP() tick count after its header, which the
+ * LogServer converts to wall-clock time. Buffered sinks prefix entries with
+ * <tt>seconds.nanoseconds </tt> since the epoch, PrintSink calls #QUICKLOG_PRINT_TIMESTAMP.
+ * 
+ * Defaults to 0.
+ */
+#ifndef QUICKLOG_TIMESTAMPS
+#define QUICKLOG_TIMESTAMPS 0
+#endif
 
-            if(align_sz + m_pos > size){
-                return false;
-            }
 
-            // this will break if used with multiple inheritance
-            auto dest = reinterpret_cast< LogEntry<Ts ...>*>( &m_buffer[m_pos] );
-            new (dest) LogEntry<Ts ...>(vs ...);
+/**
+ * @def QUICKLOG_STATS
+ */
+/**
+ * @brief Define as 0 to stop loggers and the LogServer keeping the counters returned by
+ * LocalLoggerBase::stats() and LogServer::stats(), which are then always 0.
+ * 
+ * Defaults to 1. Each counter only has one writer, so counting is a plain load and
+ * store, on cache lines the writer owns.
+ */
+#ifndef QUICKLOG_STATS
+#define QUICKLOG_STATS 1
+#endif
 
-            m_pos += align_sz;
-            m_count ++;
-            return true;
-        }
 
-        void clear(){
-            m_count = 0;
-            m_pos = 0;
-        }
+/**
+ * @def QUICKLOG_COROUTINES
+ */
+/**
+ * @brief Whether to compile quicklog::durable(), for co_await'ing LogServer::onDurable().
+ * Defaults to 1 when the compiler supports C++20 coroutines.
+ */
+#ifndef QUICKLOG_COROUTINES
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define QUICKLOG_COROUTINES 1
+#else
+#define QUICKLOG_COROUTINES 0
+#endif
+#endif
 
-        bool isEmpty(){
-            return m_pos == 0;
-        }
+#if QUICKLOG_COROUTINES
+#include <coroutine>
+#endif
 
-        void dump(){
-            size_t dump_pos = 0;
-            for(size_t i=0; i<m_count; i++){
-                LogEntryBase * entry = reinterpret_cast<LogEntryBase*> (& m_buffer[dump_pos]);
-                entry->printSelf();
-                dump_pos += alignedSize(entry->size);
-            }
-            clear();
-        }
-    private:
-        size_t m_count = 0;
-        size_t m_pos = 0;
-        uint8_t m_buffer[size] alignas(QUICKLOG_ALIGN);
-    };
 
+/**
+ * @def QUICKLOG_TIMESTAMP()
+ */
+/**
+ * @brief Read the tick counter used for entry timestamps, as a uint64_t. The LogServer
+ * calibrates it against the wall clock, so any monotonic counter with a constant rate works.
+ * 
+ * Defaults to the time stamp counter on x86 (rdtsc), the virtual counter on AArch64
+ * (cntvct_el0), and std::chrono::steady_clock elsewhere.
+ */
+#ifndef QUICKLOG_TIMESTAMP
+#define QUICKLOG_TIMESTAMP() quicklog::detail::readTicks()
+#endif
 
 
-}; // detail
+/**
+ * @def QUICKLOG_PRINT_TIMESTAMP(seconds, nanoseconds)
+ */
+/**
+ * @brief Called by PrintSink LogServers before #QUICKLOG_PRINT for each entry if
+ * #QUICKLOG_TIMESTAMPS is set. Takes the entry's time as unsigned long long seconds and
+ * nanoseconds since the epoch.
+ * 
+ * Defaults to printf("%llu.%09llu ", ...) if #QUICKLOG_PRINT isn't defined, otherwise does nothing.
+ */
+#ifndef QUICKLOG_PRINT_TIMESTAMP
+#ifdef QUICKLOG_DEFAULT_PRINT
+#define QUICKLOG_PRINT_TIMESTAMP(seconds, nanoseconds) printf("%llu.%09llu ", (seconds), (nanoseconds))
+#else
+#define QUICKLOG_PRINT_TIMESTAMP(seconds, nanoseconds) ((void)(seconds), (void)(nanoseconds))
+#endif
+#endif
+
+/**
+ * @brief main namespace
+ * 
+ */
+namespace quicklog{
 
-using namespace detail;
 
 /**
- * @brief Thread-local logger component.
+ * @brief Record alignment policy. Every record starts on an @p align byte boundary.
  * 
- * Stores log entries without processing them in anyway. Calls to \ref log() will effectively
- * result the arguments being memcpy'd into a buffer (ie: buffer). When the buffer fills up 
- * LogServer will "dump" the results and call #QUICKLOG_PRINT on the original arguments to \ref log().
- * By default #QUICKLOG_PRINT is printf, but it can be #define'd  as any function you want, with any type-signature,
- * as long as it matches the corresponding call to \ref log().
+ * Arguments needing stricter alignment than @p align are memcpy'd in and out of
+ * the buffer, and so must be trivially copyable. The smaller @p align is, the more
+ * entries fit in a buffer.
  * 
- * @tparam numBuffers The number of buffers.
- * @tparam bufferSize The size of the buffers in bytes.
+ * @tparam align A power of two no greater than #QUICKLOG_ALIGN.
  */
-template<size_t numBuffers, size_t bufferSize>
-class LocalLogger: public LocalLoggerBase
-{
-public:
-    /**
-     * @brief Submit a log message.
-     * 
-     * Will not block or make any calls to snprintf etc.
-     * 
-     * @tparam Ts arbitrary types.
-     * @param vs arbitrary values.
-     */
-    template <typename ...Ts>
-    void log(Ts ... vs){
-        if(full()){
-            QUICKLOG_ERROR("LocalLogger full. Can't log()\n");
-            return;
-        }
+template<size_t align>
+struct FixedAlign{
+    static_assert(align && !(align & (align - 1)) && align <= QUICKLOG_ALIGN, "Invalid record alignment.");
+    static constexpr size_t recordAlign = align;
+    static constexpr bool natural = false;
+};
 
-        bool success = buffers[writeIndex].pushEntry(vs ...);
-        if(!success){
-            nextIndex();
-            success = buffers[writeIndex].pushEntry(vs ...);
-            if(!success){
-                QUICKLOG_ERROR("Log entries bigger than buffer size\n");
-            }
-        }
-    }
+/**
+ * @brief Record alignment policy. Every record starts on a #QUICKLOG_ALIGN boundary.
+ * 
+ * The default.
+ */
+typedef FixedAlign<QUICKLOG_ALIGN> MaxAlign;
 
-    /**
-     * @brief Flush the current buffer.
-     * 
-     *  Flushes the current buffer and makes it available to be "dumped" by the LogServer.
-     *  If this function is never called, and there are no more calls to \ref log(), more recent 
-     *  log entries will never be printed. 
-     */
-    void flush(){
-        if(!buffers[writeIndex].isEmpty()){
-            nextIndex();
-        }
-    }
+/**
+ * @brief Record alignment policy. Records are packed back to back, padded only as
+ * much as their most strictly aligned argument requires.
+ */
+struct NaturalAlign{
+    static constexpr size_t recordAlign = 1;
+    static constexpr bool natural = true;
+};
 
-private:
-    virtual bool dump(){
-        if(buffersFull.peek()){
-            // don't get() from buffersFull until after we've dump()'d the buffer.
-            QUICKLOG_MEMORY_FENCE;
-            buffers[readIndex].dump();
-            ++readIndex;
-            QUICKLOG_MEMORY_FENCE;
-            buffersFull.get(); //guaranteed to succeed
-            return true;
-        }
-        return false;
-    }
 
+/**
+ * @brief Severity of a #QUICKLOG call site.
+ */
+enum class Level : uint8_t{
+    trace,
+    debug,
+    info,
+    warning,
+    error,
+    fatal
+};
 
-    bool full(){
-        return buffersFull.peek() == numBuffers;
-    }
 
+/**
+ * @brief A string to be copied into the log entry. See str().
+ */
+struct Str{
+    const char *data;
+    size_t length;
+};
 
-    void nextIndex(){
-        if(!full()){
-            writeIndex = (writeIndex+1) % numBuffers;
-            buffersFull.put();
+/**
+ * @brief Bytes to be copied into the log entry. See bytes().
+ */
+struct Bytes{
+    const void *data;
+    size_t size;
+};
+
+/**
+ * @brief LocalLogger numBuffers and bufferSize for buffers sized when the logger is
+ * constructed, and allocated from an allocator such as Arena.
+ */
+constexpr size_t dynamic = 0;
+
+/**
+ * @brief What a LocalLogger or RingLocalLogger has done so far. See LocalLoggerBase::stats().
+ */
+struct LoggerStats{
+    /** @brief Entries logged, including #QUICKLOG_DROPPED reports. */
+    uint64_t entries;
+    /** @brief Bytes of records written, including alignment and padding. */
+    uint64_t bytes;
+    /** @brief Buffers handed over to the server (LocalLogger), or times it was notified (RingLocalLogger). */
+    uint64_t handovers;
+    /**
+     * @brief The most buffers full at once (LocalLogger), or the most bytes of the ring in use
+     * as far as the producer could tell (RingLocalLogger). Out of capacity.
+     */
+    uint64_t peakUsed;
+    /** @brief numBuffers or ringSize. */
+    uint64_t capacity;
+    /** @brief Times log() found the logger full and fell back on its OverflowPolicy. */
+    uint64_t full;
+    /** @brief Entries lost to OverflowPolicy. */
+    uint64_t dropped;
+    /** @brief Entries the server has printed. */
+    uint64_t printed;
+    /** @brief The logger's LogServer slot, to tell loggers apart. */
+    size_t slot;
+};
+
+/**
+ * @brief What a LogServer worker has done so far. See LogServer::stats().
+ */
+struct ServerStats{
+    /** @brief Times PlatformImpl::wait() returned. */
+    uint64_t wakeups;
+    /** @brief Passes over the loggers that printed something. */
+    uint64_t passes;
+    /** @brief Entries printed, including by loggers since removed. */
+    uint64_t entries;
+    /** @brief Time spent in those passes, in nanoseconds. */
+    uint64_t busyNs;
+    /** @brief The longest of them, in nanoseconds. */
+    uint64_t maxPassNs;
+};
+
+/**
+ * @brief Copy a string into the log entry instead of storing the pointer, so it needn't
+ * outlive the call to log(). Truncated to #QUICKLOG_MAX_COPY bytes.
+ * 
+ * Printed as a const char*, e.g. with %s.
+ */
+inline Str str(const char *s){
+    if(!s){
+        return Str{"(null)", 6};
+    }
+    size_t length = 0;
+    while(length < QUICKLOG_MAX_COPY && s[length]){
+        ++length;
+    }
+    return Str{s, length};
+}
+
+/**
+ * @brief Copy length characters of s into the log entry, e.g. from a std::string.
+ * Truncated to #QUICKLOG_MAX_COPY bytes.
+ */
+inline Str str(const char *s, size_t length){
+    return Str{s, length < QUICKLOG_MAX_COPY ? length : QUICKLOG_MAX_COPY};
+}
+
+/**
+ * @brief Copy size bytes from data into the log entry. Truncated to #QUICKLOG_MAX_COPY bytes.
+ * 
+ * Printed as a const char* to their lowercase hex digits, e.g. with %s.
+ */
+inline Bytes bytes(const void *data, size_t size){
+    return Bytes{data, size < QUICKLOG_MAX_COPY ? size : QUICKLOG_MAX_COPY};
+}
+
+/**
+ * @brief Bounded text that a serializer formats a value into. Anything past the capacity
+ * is dropped.
+ */
+class TextWriter{
+public:
+    /** @param dest room for capacity characters and a terminating 0. */
+    TextWriter(char *dest, size_t capacity) : m_dest(dest), m_capacity(capacity){}
+
+    void write(const char *data, size_t length){
+        length = std::min(length, m_capacity - m_length);
+        memcpy(m_dest + m_length, data, length);
+        m_length += length;
+    }
+
+    void write(const char *s){
+        write(s, strlen(s));
+    }
+
+    /** @brief Append snprintf(format, vs ...). */
+    template<typename ...Ts>
+    void print(const char *format, Ts ... vs){
+        const int n = snprintf(m_dest + m_length, m_capacity - m_length + 1, format, vs ...);
+        if(n > 0){
+            m_length = std::min(m_length + static_cast<size_t>(n), m_capacity);
+        }
+    }
+
+    size_t length() const{
+        return m_length;
+    }
+
+private:
+    char *m_dest;
+    size_t m_capacity;
+    size_t m_length = 0;
+};
+
+/**
+ * @brief Customization point for logging values of type T that aren't trivially copyable, or
+ * can be stored in fewer bytes than their sizeof.
+ * 
+ * Specialize it with:
+ * - <tt>static constexpr size_t maxSize;</tt> the most bytes encode() writes.
+ * - <tt>static size_t size(const T & v);</tt> the bytes encode(v, ...) will write. No more
+ *   than maxSize, otherwise log() calls #QUICKLOG_ERROR and, if it returns, logs the value
+ *   as empty text.
+ * - <tt>static void encode(const T & v, uint8_t *dst);</tt> called by log(). dst isn't aligned.
+ * - <tt>static void format(const uint8_t *src, size_t size, TextWriter & out);</tt> called by
+ *   the server to turn the encoding back into text.
+ * 
+ * The encoding is copied into the record after the payload, as bytes() are, and the value
+ * is printed as a const char* to the text, e.g. with %s. Core files and quicklog_drain.cpp
+ * can't run format(), and show the encoding in hex instead. See encodeVarint() for compact
+ * integers.
+ */
+template<typename T, typename Enable = void>
+struct serializer{};
+
+/** @brief Bytes encodeVarint() writes for v, 1 to 10. */
+constexpr size_t varintSize(uint64_t v){
+    return v < 0x80 ? 1 : 1 + varintSize(v >> 7);
+}
+
+/**
+ * @brief Write v 7 bits at a time, low bits first, setting the top bit of every byte but the last.
+ * 
+ * @return varintSize(v)
+ */
+inline size_t encodeVarint(uint64_t v, uint8_t *dst){
+    size_t n = 0;
+    while(v >= 0x80){
+        dst[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    dst[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+/** @brief Read a value written by encodeVarint(), advancing src past it. */
+inline uint64_t decodeVarint(const uint8_t *& src){
+    uint64_t v = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7){
+        const uint8_t b = *src++;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if(!(b & 0x80)){
+            break;
+        }
+    }
+    return v;
+}
+
+/** @brief Map signed values to unsigned ones so that small negative deltas make short varints. */
+constexpr uint64_t zigzag(int64_t v){
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+/** @brief Inverse of zigzag(). */
+constexpr int64_t unzigzag(uint64_t v){
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+
+/**
+ * @brief A callback waiting for LogServer::onDurable(). Belongs to the caller, and must stay
+ * valid until fn is called.
+ */
+struct DurableCallback{
+    // durable is false if the server shut down or the logger was removed first.
+    void (*fn)(void *arg, bool durable) = nullptr;
+    void *arg = nullptr;
+
+    // set by onDurable().
+    uint64_t position = 0;
+    DurableCallback *next = nullptr;
+};
+
+
+/**
+ * @brief Private implementation details.
+ * 
+ */
+namespace detail {
+
+    /** @brief Whether level is at or above #QUICKLOG_MIN_LEVEL. */
+    constexpr bool compiledIn(Level level){
+        return static_cast<int>(level) >= static_cast<int>(QUICKLOG_MIN_LEVEL);
+    }
+
+    /** @brief Add n to a #QUICKLOG_STATS counter that only the calling thread writes. */
+    inline void statAdd(std::atomic<uint64_t> & counter, uint64_t n = 1){
+        if(QUICKLOG_STATS){
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    }
+
+    /** @brief Raise a #QUICKLOG_STATS peak that only the calling thread writes to v. */
+    inline void statMax(std::atomic<uint64_t> & counter, uint64_t v){
+        if(QUICKLOG_STATS && v > counter.load(std::memory_order_relaxed)){
+            counter.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    class LogServerBase{
+    public:
+        virtual void _onDumpAvail() = 0;
+        virtual void _waitForSpace() = 0;
+
+        std::atomic<int> _spaceWaiters{0};
+        // set by onDurable() for a callback the server passed before it was added.
+        std::atomic<bool> _waitersDue{false};
+        // set once the worker has finished its final pass and won't touch its loggers again.
+        std::atomic<bool> _stopped{false};
+    };
+
+    /**
+     * @brief What a binary LogServer has written so far. See BinarySink.
+     */
+    struct BinaryState{
+        bool headerWritten = false;
+        // only do what's async-signal-safe, for LogServer::crashDump().
+        bool signalSafe = false;
+        // indexed by decoder id, up to DecoderTable::overflowId.
+        bool described[QUICKLOG_MAX_ENTRY_TYPES + 1] = {};
+
+        /** @brief Start again with the file header, e.g. when the sink moves to a new file. */
+        void reset(){
+            headerWritten = false;
+            memset(described, 0, sizeof(described));
+        }
+    };
+
+
+    /**
+     * @brief Where a sink that can be written into directly wants its next output, e.g.
+     * a mapping of its file. See MmapSink.
+     */
+    struct OutputWindow{
+        // nullptr to use the staging buffer instead.
+        char *data;
+        size_t size;
+        // the sink started a new file, so the binary format starts again with its header.
+        bool newFile;
+    };
+
+
+    /**
+     * @brief Server-side staging buffer that entries are formatted into.
+     * 
+     * Passes its contents to the LogServer's sink when it fills up or is flush()'d.
+     */
+    class OutputBuffer{
+    public:
+        typedef void (*WriteFunc)(void *sink, const char *data, size_t size);
+        typedef OutputWindow (*WindowFunc)(void *sink, bool boundary);
+
+        /**
+         * @param window If not null, called after each flush() for the space to write into
+         * next. Output goes to buffer whenever it returns no window.
+         */
+        OutputBuffer(char *buffer, size_t size, WriteFunc write, void *sink, BinaryState *binary = nullptr,
+                     WindowFunc window = nullptr)
+            : m_begin(buffer), m_pos(buffer), m_end(buffer + size), m_write(write), m_sink(sink), m_binary(binary),
+              m_window(window), m_staging(buffer), m_stagingEnd(buffer + size)
+        {}
+
+        /** @brief Non-null if entries are to be written in the binary format. */
+        BinaryState * binary(){
+            return m_binary;
+        }
+
+        char * pos(){
+            return m_pos;
+        }
+
+        size_t available(){
+            return m_end - m_pos;
+        }
+
+        bool isEmpty(){
+            return m_pos == m_begin;
+        }
+
+        void advance(size_t n){
+            m_pos += n;
+        }
+
+        /**
+         * @param boundary Whether the output so far ends with a whole entry, so the sink
+         * could move on to a new file.
+         */
+        void flush(bool boundary = false){
+            if(!isEmpty()){
+                m_write(m_sink, m_begin, m_pos - m_begin);
+                m_pos = m_begin;
+            }
+            if(m_window){
+                const OutputWindow window = m_window(m_sink, boundary);
+                if(window.newFile && m_binary){
+                    m_binary->reset();
+                }
+                m_begin = m_pos = window.data ? window.data : m_staging;
+                m_end = window.data ? window.data + window.size : m_stagingEnd;
+            }
+        }
+
+        /**
+         * @brief Say that the output so far ends with a whole entry, so that a sink with a
+         * window can move on to a new file here. Does nothing for other sinks.
+         */
+        void boundary(){
+            if(m_window){
+                flush(true);
+            }
+        }
+
+        void write(const char *data, size_t size){
+            while(size){
+                if(!available()){
+                    flush();
+                }
+                const size_t n = size < available() ? size : available();
+                memcpy(m_pos, data, n);
+                m_pos += n;
+                data += n;
+                size -= n;
+            }
+        }
+
+    private:
+        char * m_begin;
+        char * m_pos;
+        char * m_end;
+        WriteFunc m_write;
+        void * m_sink;
+        BinaryState * m_binary;
+        WindowFunc m_window;
+        char * const m_staging;
+        char * const m_stagingEnd;
+    };
+
+
+    inline uint64_t readTicks(){
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+
+    /** @brief Hint to the CPU that this is a spin loop. */
+    inline void cpuRelax(){
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+
+    /**
+     * @brief What quicklog_core.py needs to find unprinted entries in a core file.
+     * 
+     * The decoder table and every registered logger start with a 16 byte magic string, so
+     * they can be found by searching the core's memory. The table's magic is followed by
+     * <tt>uint16_t headerSize; uint16_t count; uint32_t maxTypes;</tt> and, pointer aligned,
+     * the maxTypes long arrays of decoders, SiteInfo pointers and RecordLayout pointers. A logger's CrashDescriptor
+     * holds the addresses of its state, see the Field indices below.
+     */
+    namespace crash{
+        constexpr char loggerMagic[16] = "quicklog-logger";
+
+        enum Field{
+            kind,
+            clockStartTicks,
+            clockStartNs,
+            clockNsPerTick,
+            // the kind specific fields.
+            first,
+            numFields = 16
+        };
+
+        enum Kind{
+            // LocalLogger: numBuffers, the buffer stride, the addresses of buffers[0]'s
+            // count, position and data, writeIndex, readIndex, recordPos, recordsLeft,
+            // and the put and get counters.
+            buffers = 1,
+            // RingLocalLogger: ringSize, the addresses of ring, readPos and committed.
+            ring = 2
+        };
+    }
+
+    /** @brief Addresses of a logger's state for quicklog_core.py. See crash. */
+    struct CrashDescriptor{
+        char magic[16];
+        uint64_t fields[crash::numFields];
+
+        template<typename T>
+        void set(size_t field, const T *address){
+            fields[field] = reinterpret_cast<uintptr_t>(address);
+        }
+    };
+
+
+    /** @brief #QUICKLOG_TIMESTAMP() ticks per second as last calibrated, or 0. See ticksPerSecond(). */
+    inline std::atomic<uint64_t> & tickRate(){
+        static std::atomic<uint64_t> rate{0};
+        return rate;
+    }
+
+
+    /**
+     * @brief Converts #QUICKLOG_TIMESTAMP() ticks to nanoseconds since the epoch.
+     * 
+     * Owned and calibrated by a LogServer thread. The first calibrate() measures the tick
+     * rate over a short busy wait, later ones refine it over the whole time since the first,
+     * following any adjustments to the system clock.
+     */
+    class TimestampClock{
+    public:
+        void calibrate(){
+            uint64_t ticks;
+            int64_t ns;
+            if(!m_calibrated){
+                wallClock(); // the first call can be slow.
+                sample(m_startTicks, m_startNs);
+                do{
+                    sample(ticks, ns);
+                }while(ns - m_startNs < initialCalibrationNs || ticks == m_startTicks);
+                m_calibrated = true;
+            }else{
+                sample(ticks, ns);
+            }
+            m_nsPerTick = static_cast<double>(ns - m_startNs) / static_cast<double>(ticks - m_startTicks);
+            tickRate().store(ticksIn(1000000000), std::memory_order_relaxed);
+            m_lastTicks = ticks;
+            m_intervalTicks = static_cast<uint64_t>(calibrationIntervalNs / m_nsPerTick);
+        }
+
+        /** @brief calibrate() if it's been calibrationIntervalNs since the last time. Cheap. */
+        void update(){
+            if(QUICKLOG_TIMESTAMP() - m_lastTicks >= m_intervalTicks){
+                calibrate();
+            }
+        }
+
+        /** @brief The number of ticks in a duration of ns nanoseconds. */
+        uint64_t ticksIn(uint64_t ns) const{
+            return static_cast<uint64_t>(static_cast<double>(ns) / m_nsPerTick);
+        }
+
+        /** @brief The number of nanoseconds in a duration of ticks. */
+        uint64_t nanosecondsIn(uint64_t ticks) const{
+            return static_cast<uint64_t>(static_cast<double>(ticks) * m_nsPerTick);
+        }
+
+        uint64_t toNanoseconds(uint64_t ticks) const{
+            const int64_t delta = static_cast<int64_t>(ticks - m_startTicks);
+            return m_startNs + static_cast<int64_t>(static_cast<double>(delta) * m_nsPerTick);
+        }
+
+        static constexpr int64_t initialCalibrationNs = 1000000;
+        static constexpr int64_t calibrationIntervalNs = 1000000000;
+
+        void describe(CrashDescriptor & crash) const{
+            crash.set(crash::clockStartTicks, &m_startTicks);
+            crash.set(crash::clockStartNs, &m_startNs);
+            crash.set(crash::clockNsPerTick, &m_nsPerTick);
+        }
+
+    private:
+        /** @brief Read both clocks, taking the tick count halfway through reading the wall clock. */
+        static void sample(uint64_t & ticks, int64_t & ns){
+            const uint64_t before = QUICKLOG_TIMESTAMP();
+            ns = wallClock();
+            ticks = before + (QUICKLOG_TIMESTAMP() - before) / 2;
+        }
+
+        static int64_t wallClock(){
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        bool m_calibrated = false;
+        uint64_t m_startTicks = 0;
+        int64_t m_startNs = 0;
+        uint64_t m_lastTicks = 0;
+        uint64_t m_intervalTicks = 0;
+        double m_nsPerTick = 1;
+    };
+
+
+    /** @brief The levels a logger logs #QUICKLOG_SITE entries at. */
+    class LevelFilter{
+    public:
+        /**
+         * @brief Only log #QUICKLOG_SITE entries at level or above. Can be called from any
+         * thread, e.g. to turn on Level::debug for one thread.
+         */
+        void setLevel(Level level){
+            m_levels.store(static_cast<uint8_t>(0xff << static_cast<int>(level)), std::memory_order_relaxed);
+        }
+
+        /** @brief Turn logging at level on or off. Can be called from any thread. */
+        void enableLevel(Level level, bool enable = true){
+            const uint8_t bit = static_cast<uint8_t>(1 << static_cast<int>(level));
+            if(enable){
+                m_levels.fetch_or(bit, std::memory_order_relaxed);
+            }else{
+                m_levels.fetch_and(static_cast<uint8_t>(~bit), std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Whether entries at level are logged, both compiled in by #QUICKLOG_MIN_LEVEL
+         * and turned on. Entries without a level, i.e. not #QUICKLOG_SITE, always are.
+         */
+        bool levelEnabled(Level level) const{
+            return compiledIn(level) && ((m_levels.load(std::memory_order_relaxed) >> static_cast<int>(level)) & 1);
+        }
+
+    protected:
+        // bit n set if Level n is turned on.
+        std::atomic<uint8_t> m_levels{0xff};
+    };
+
+
+    class LocalLoggerBase: public LevelFilter{
+    public:
+	    virtual bool dump(OutputBuffer *out, const TimestampClock & clock) = 0;
+
+        /**
+         * @brief The next record to be dumped, or nullptr if there isn't one yet. Stays
+         * the same until pop(). Used by LogServer::mergeByTimestamp().
+         */
+        virtual const uint8_t * peek() = 0;
+
+        /**
+         * @brief Decode the record returned by peek() and move on to the next one.
+         * 
+         * @return true if that frees space for the producer.
+         */
+        virtual bool pop(OutputBuffer *out, const TimestampClock & clock) = 0;
+
+        /**
+         * @brief Decode every entry that hasn't been printed yet, including any the logger
+         * hasn't handed over, without changing any state. For LogServer::crashDump().
+         */
+        virtual void crashDump(OutputBuffer *out, const TimestampClock & clock) = 0;
+
+        /**
+         * @brief For LogServer::autoFlush(). Let dump() and peek() have the entries the logger
+         * hasn't handed over yet, once the server has seen them waiting for maxAgeNs.
+         * 
+         * @param nowNs The time of the server's pass, on any clock that only goes forward.
+         */
+        virtual void takeStale(uint64_t nowNs, uint64_t maxAgeNs){
+            (void)nowNs;
+            (void)maxAgeNs;
+        }
+
+        /**
+         * @brief The logger's counters so far. Can be called from any thread, in which case
+         * they may be a few entries apart. See #QUICKLOG_STATS.
+         */
+        LoggerStats stats() const{
+            LoggerStats stats;
+            stats.entries = m_counters.entries.load(std::memory_order_relaxed);
+            stats.bytes = m_counters.bytes.load(std::memory_order_relaxed);
+            stats.handovers = m_counters.handovers.load(std::memory_order_relaxed);
+            stats.peakUsed = m_counters.peakUsed.load(std::memory_order_relaxed);
+            stats.capacity = m_capacity;
+            stats.full = m_counters.full.load(std::memory_order_relaxed);
+            stats.dropped = m_counters.dropped.load(std::memory_order_relaxed);
+            stats.printed = m_printed.load(std::memory_order_relaxed);
+            stats.slot = _slot;
+            return stats;
+        }
+
+        // LogServer::removeLogger() handshake. Set by the logger's thread once it's committed
+        // everything, and by the server once it's printed everything and given up the slot.
+        std::atomic<bool> _removing{false};
+        std::atomic<bool> _removed{false};
+        // set by the server once it won't call the logger's onDurable() callbacks any more.
+        std::atomic<bool> _waitersClosed{false};
+        size_t _slot = 0;
+        CrashDescriptor _crash = {};
+
+        // entries printed, for LogServer::stats().
+        uint64_t _printed() const{
+            return m_printed.load(std::memory_order_relaxed);
+        }
+
+        /** @brief Whether the server has passed everything before position to its sink. */
+        bool _durable(uint64_t position) const{
+            // pairs with _addWaiter() in LogServer::onDurable().
+            return m_durable.load(std::memory_order_seq_cst) >= position;
+        }
+
+        /** @brief For LogServer::onDurable(). From any thread. */
+        void _addWaiter(DurableCallback *callback){
+            DurableCallback *head = m_waiters.load(std::memory_order_relaxed);
+            do{
+                callback->next = head;
+            }while(!m_waiters.compare_exchange_weak(head, callback, std::memory_order_seq_cst, std::memory_order_relaxed));
+        }
+
+        /**
+         * @brief Call the onDurable() callbacks whose positions are durable. With final, e.g.
+         * once nothing else will, call the rest too, saying they aren't.
+         */
+        void _callWaiters(bool final){
+            if(!m_waiters.load(std::memory_order_seq_cst)){
+                return;
+            }
+            DurableCallback *waiters = m_waiters.exchange(nullptr, std::memory_order_acq_rel);
+            const uint64_t durable = m_durable.load(std::memory_order_relaxed);
+            while(waiters){
+                DurableCallback *callback = waiters;
+                // fn may free the callback, or add it again.
+                waiters = callback->next;
+                const bool done = durable >= callback->position;
+                if(done || final){
+                    callback->fn(callback->arg, done);
+                }else{
+                    _addWaiter(callback);
+                }
+            }
+        }
+
+        /**
+         * @brief Called by the server at the end of a pass, once what it printed has been
+         * passed to the sink. Calls the onDurable() callbacks that are due.
+         */
+        void _markDurable(){
+            m_durable.store(_readCursor(), std::memory_order_seq_cst);
+            _callWaiters(false);
+        }
+
+    protected:
+        struct ProducerCounters{
+            std::atomic<uint64_t> entries{0};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> handovers{0};
+            std::atomic<uint64_t> peakUsed{0};
+            std::atomic<uint64_t> full{0};
+            std::atomic<uint64_t> dropped{0};
+        };
+
+        /**
+         * @brief How far the server has read, in the units of the positions flush() returns.
+         * Only called by the server.
+         */
+        virtual uint64_t _readCursor() = 0;
+
+        // numBuffers or ringSize, set by the derived class.
+        size_t m_capacity = 0;
+
+        // producer side
+        alignas(QUICKLOG_CACHE_LINE) ProducerCounters m_counters;
+        // server side
+        alignas(QUICKLOG_CACHE_LINE) std::atomic<uint64_t> m_printed{0};
+        // _readCursor() at the end of the server's last pass.
+        std::atomic<uint64_t> m_durable{0};
+
+        // LogServer::onDurable() callbacks, pushed by any thread.
+        alignas(QUICKLOG_CACHE_LINE) std::atomic<DurableCallback*> m_waiters{nullptr};
+    };
+
+    /**
+     * @brief Special purpose semaphore implementation.
+     * 
+     * This isn't a normal semaphore. It only works if only one thread is allowed to
+     * call put()/peek(). Each put is claim()'d and then get()'d by a consumer. Normally the
+     * only consumer is the LogServer thread, but a LocalLogger using OverwriteOldest
+     * also claims puts, which is why the claim and get counters are read-modify-writes.
+     * Counters are 32 bits and wrap, so there can be at most 2^32 - 1 unmatched puts. Comparing
+     * a consumer's own last claim with the claim counter tells it how many claims other
+     * consumers made since.
+     * 
+     * put() releases, and claim() acquires, whatever the producer wrote before the put().
+     * get() releases, and peek() acquires, whatever the consumer did before the get().
+     * Producer and consumer counters are kept on separate cache lines.
+     * 
+     */
+    class semaphore{
+    public:
+        void put(){
+            numPuts.store(numPuts.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Producer only.
+         * 
+         * Only rereads the consumer's counter when the count last seen is at least limit,
+         * so the producer doesn't touch the consumer's cache line on every call.
+         * 
+         * @return uint32_t Current semaphore count.
+         */
+        uint32_t peek(uint32_t limit){
+            uint32_t count = numPuts.load(std::memory_order_relaxed) - cachedGets;
+            if(count >= limit){
+                cachedGets = numGets.load(std::memory_order_acquire);
+                count = numPuts.load(std::memory_order_relaxed) - cachedGets;
+            }
+            return count;
+        }
+
+        /**
+         * @brief Number of puts not yet claimed by a consumer.
+         * 
+         * @param claims A value previously returned by claims().
+         */
+        uint32_t unclaimed(uint32_t claims){
+            return numPuts.load(std::memory_order_acquire) - claims;
+        }
+
+        uint32_t claims(){
+            return numClaims.load(std::memory_order_relaxed);
+        }
+
+        uint32_t gets(){
+            return numGets.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Claim the oldest unclaimed put.
+         * 
+         * @param claims Expected value of claims(). Updated if the claim fails.
+         * @return true if the claim succeeded.
+         */
+        bool claim(uint32_t & claims){
+            return numClaims.compare_exchange_strong(claims, claims+1,
+                std::memory_order_acq_rel, std::memory_order_relaxed);
+        }
+
+        /** 
+         * @brief Decrement semaphore count. Assume a put was claim()'d already and
+         * decrement without checking.
+         */
+        void get(){
+            numGets.fetch_add(1, std::memory_order_release);
+        }
+
+        void describe(CrashDescriptor & crash, size_t field) const{
+            crash.set(field, &numPuts);
+            crash.set(field + 1, &numGets);
+        }
+
+    private:
+        alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> numPuts{0};
+        uint32_t cachedGets = 0;
+        alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> numClaims{0};
+        std::atomic<uint32_t> numGets{0};
+    };
+
+
+    template<class P>
+    auto waitSpace(P & platform, int) -> decltype(platform.waitSpace()){
+        return platform.waitSpace();
+    }
+
+    template<class P>
+    void waitSpace(P &, long){}
+
+    template<class P>
+    auto notifySpace(P & platform, int) -> decltype(platform.notifySpace()){
+        return platform.notifySpace();
+    }
+
+    template<class P>
+    void notifySpace(P &, long){}
+
+    template<class P, class Poll>
+    auto waitFor(P & platform, Poll poll, int) -> decltype(platform.wait(poll)){
+        return platform.wait(poll);
+    }
+
+    template<class P, class Poll>
+    void waitFor(P & platform, Poll, long){
+        platform.wait();
+    }
+
+
+    /**
+     * @brief Base of the call site types created by #QUICKLOG_SITE and #QUICKLOG_FMT.
+     * 
+     * Derived types have static constexpr str(), file(), line() and level() functions
+     * returning the format string and where it was logged from.
+     */
+    struct FormatString{};
+
+
+    template<typename T>
+    using IsFormatString = std::is_base_of<FormatString, T>;
+
+
+    /**
+     * @brief The value #QUICKLOG_PRINT or #QUICKLOG_FORMAT receives for a stored argument.
+     */
+    template<typename T, typename std::enable_if<!IsFormatString<T>::value, int>::type = 0>
+    const T & presentArg(const T & v){
+        return v;
+    }
+
+    template<typename T, typename std::enable_if<IsFormatString<T>::value, int>::type = 0>
+    const char * presentArg(const T &){
+        return T::str();
+    }
+
+
+    /**
+     * @brief bytes() as presented to #QUICKLOG_PRINT, a string of hex digits.
+     */
+    struct HexString{
+        char data[2 * QUICKLOG_MAX_COPY + 1];
+    };
+
+    inline const char * presentArg(const HexString & hex){
+        return hex.data;
+    }
+
+
+    /**
+     * @brief A serializer's formatted value as presented to #QUICKLOG_PRINT.
+     */
+    struct SerializedText{
+        char data[QUICKLOG_MAX_TEXT + 1];
+    };
+
+    inline const char * presentArg(const SerializedText & text){
+        return text.data;
+    }
+
+
+    template<typename T, typename = void>
+    struct HasSerializer : std::false_type{};
+
+    template<typename T>
+    struct HasSerializer<T, decltype(serializer<T>::encode(std::declval<const T &>(), std::declval<uint8_t*>()))>
+        : std::true_type{};
+
+
+    /**
+     * @brief Where Str and Bytes keep their data, relative to the start of the record.
+     */
+    struct CopiedBytes{
+        uint16_t offset;
+        uint16_t size;
+    };
+
+
+    /**
+     * @brief How a log() argument of type T is stored in a record and handed back when decoding.
+     * 
+     * Stored goes in the record's payload tuple. Arguments with copied data, e.g. Str,
+     * also have up to maxCopy bytes after the tuple. store() writes the copy at
+     * record + offset and advances offset. load() turns a Stored back into the Loaded value
+     * presented to #QUICKLOG_PRINT. By default arguments are stored as they are.
+     */
+    template<typename T, typename Enable = void>
+    struct ArgTraits{
+        typedef T Stored;
+        typedef const T & Loaded;
+        static constexpr size_t maxCopy = 0;
+
+        static size_t copySize(const T &){
+            return 0;
+        }
+
+        static const T & store(const T & v, uint8_t *, size_t &){
+            return v;
+        }
+
+        static const T & load(const T & v, const uint8_t *){
+            return v;
+        }
+    };
+
+
+    template<>
+    struct ArgTraits<Str>{
+        typedef CopiedBytes Stored;
+        typedef const char * Loaded;
+        static constexpr size_t maxCopy = QUICKLOG_MAX_COPY + 1;
+
+        static size_t copySize(const Str & v){
+            return v.length + 1;
+        }
+
+        static Stored store(const Str & v, uint8_t *record, size_t & offset){
+            memcpy(record + offset, v.data, v.length);
+            record[offset + v.length] = 0;
+            const Stored stored = {static_cast<uint16_t>(offset), static_cast<uint16_t>(v.length)};
+            offset += v.length + 1;
+            return stored;
+        }
+
+        static Loaded load(const Stored & v, const uint8_t *record){
+            return reinterpret_cast<const char*>(record + v.offset);
+        }
+    };
+
+
+    /** @brief Write size bytes as 2 * size lowercase hex digits and a terminating 0. */
+    inline void toHex(const uint8_t *bytes, size_t size, char *dst){
+        const char *digits = "0123456789abcdef";
+        for(size_t i=0; i<size; i++){
+            dst[2*i] = digits[bytes[i] >> 4];
+            dst[2*i + 1] = digits[bytes[i] & 0xf];
+        }
+        dst[2 * size] = 0;
+    }
+
+
+    template<>
+    struct ArgTraits<Bytes>{
+        typedef CopiedBytes Stored;
+        typedef HexString Loaded;
+        static constexpr size_t maxCopy = QUICKLOG_MAX_COPY;
+
+        static size_t copySize(const Bytes & v){
+            return v.size;
+        }
+
+        static Stored store(const Bytes & v, uint8_t *record, size_t & offset){
+            memcpy(record + offset, v.data, v.size);
+            const Stored stored = {static_cast<uint16_t>(offset), static_cast<uint16_t>(v.size)};
+            offset += v.size;
+            return stored;
+        }
+
+        static Loaded load(const Stored & v, const uint8_t *record){
+            HexString hex;
+            toHex(record + v.offset, v.size, hex.data);
+            return hex;
+        }
+    };
+
+
+    template<typename T>
+    struct ArgTraits<T, typename std::enable_if<HasSerializer<T>::value>::type>{
+        typedef CopiedBytes Stored;
+        typedef SerializedText Loaded;
+        static constexpr size_t maxCopy = serializer<T>::maxSize;
+
+        static size_t copySize(const T & v){
+            const size_t size = serializer<T>::size(v);
+            if(size > maxCopy){
+                QUICKLOG_ERROR("serializer size() is bigger than its maxSize.\n");
+                return 0;
+            }
+            return size;
+        }
+
+        static Stored store(const T & v, uint8_t *record, size_t & offset){
+            const size_t size = serializer<T>::size(v);
+            if(size > maxCopy){
+                // there's no room for it, see copySize(). Offset 0 is the record header.
+                return Stored{0, 0};
+            }
+            serializer<T>::encode(v, record + offset);
+            const Stored stored = {static_cast<uint16_t>(offset), static_cast<uint16_t>(size)};
+            offset += size;
+            return stored;
+        }
+
+        static Loaded load(const Stored & v, const uint8_t *record){
+            SerializedText text;
+            if(v.offset == 0){
+                text.data[0] = 0;
+                return text;
+            }
+            TextWriter out(text.data, QUICKLOG_MAX_TEXT);
+            serializer<T>::format(record + v.offset, v.size, out);
+            text.data[out.length()] = 0;
+            return text;
+        }
+
+        /** @brief The encoded bytes in hex, as much as fits, without calling format(). */
+        static Loaded loadRaw(const Stored & v, const uint8_t *record){
+            SerializedText text;
+            toHex(record + v.offset, std::min<size_t>(v.size, QUICKLOG_MAX_TEXT / 2), text.data);
+            return text;
+        }
+    };
+
+
+    /**
+     * @brief ArgTraits<T>::load(), except that with signalSafe, i.e. in LogServer::crashDump(),
+     * serializer types are loaded with loadRaw(), as their format() may not be async-signal-safe.
+     */
+    template<typename T, typename std::enable_if<!HasSerializer<T>::value, int>::type = 0>
+    typename ArgTraits<T>::Loaded loadArg(const typename ArgTraits<T>::Stored & v, const uint8_t *record, bool){
+        return ArgTraits<T>::load(v, record);
+    }
+
+    template<typename T, typename std::enable_if<HasSerializer<T>::value, int>::type = 0>
+    typename ArgTraits<T>::Loaded loadArg(const typename ArgTraits<T>::Stored & v, const uint8_t *record, bool signalSafe){
+        return signalSafe ? ArgTraits<T>::loadRaw(v, record) : ArgTraits<T>::load(v, record);
+    }
+
+
+    /**
+     * @brief The type #QUICKLOG_PRINT receives for a log() argument of type T.
+     */
+    template<typename T>
+    using PresentedType = typename std::decay<
+        decltype(presentArg(std::declval<typename ArgTraits<typename std::decay<T>::type>::Loaded>()))>::type;
+
+
+    /**
+     * @brief Argument categories, as far as printf conversions are concerned.
+     */
+    enum class ArgKind : uint8_t{
+        other,
+        signedInt,
+        unsignedInt,
+        floating,
+        longDouble,
+        string,
+        pointer
+    };
+
+
+    struct ArgType{
+        ArgKind kind;
+        uint8_t size;
+    };
+
+
+    template<typename T>
+    constexpr ArgType argType(){
+        typedef PresentedType<T> D;
+        return {
+            std::is_same<D, char*>::value || std::is_same<D, const char*>::value ? ArgKind::string
+            : std::is_pointer<D>::value || std::is_same<D, std::nullptr_t>::value ? ArgKind::pointer
+            : std::is_same<D, long double>::value ? ArgKind::longDouble
+            : std::is_floating_point<D>::value ? ArgKind::floating
+            : std::is_integral<D>::value && std::is_signed<D>::value ? ArgKind::signedInt
+            : std::is_integral<D>::value ? ArgKind::unsignedInt
+            : ArgKind::other,
+            static_cast<uint8_t>(sizeof(D))
+        };
+    }
+
+
+    /**
+     * @brief A parsed printf conversion specification, and the literal text before it.
+     * 
+     * conversion is 0 for a segment that is only literal text. ie: the end of the
+     * format string, or the first % of a %%.
+     */
+    struct FormatSegment{
+        uint16_t literalBegin;
+        uint16_t literalLength;
+        uint16_t specBegin;
+        uint8_t specLength;
+        char conversion;
+        char length;    // 0, one of hljztL, 'H' for hh, or 'q' for ll.
+        uint8_t stars;  // number of * widths/precisions, each taking an int argument.
+        bool simple;    // no flags, width or precision.
+    };
+
+
+    constexpr size_t maxSpecLength = 31;
+
+
+    constexpr bool isFlag(char c){
+        return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0' || c == '\'';
+    }
+
+
+    constexpr bool isDigit(char c){
+        return c >= '0' && c <= '9';
+    }
+
+
+    /**
+     * @brief Parse the conversion specification starting at f[pos] == '%'.
+     * 
+     * @return FormatSegment with specLength 0 if the specification is invalid.
+     */
+    constexpr FormatSegment parseSpec(const char *f, size_t pos){
+        FormatSegment seg{0, 0, static_cast<uint16_t>(pos), 0, 0, 0, 0, true};
+        size_t i = pos + 1;
+        if(f[i] == '%'){
+            return seg;
+        }
+        while(isFlag(f[i])){
+            seg.simple = false;
+            ++i;
+        }
+        if(f[i] == '*'){
+            ++seg.stars;
+            ++i;
+        }
+        while(isDigit(f[i])){
+            seg.simple = false;
+            ++i;
+        }
+        if(f[i] == '.'){
+            seg.simple = false;
+            ++i;
+            if(f[i] == '*'){
+                ++seg.stars;
+                ++i;
+            }
+            while(isDigit(f[i])){
+                ++i;
+            }
+        }
+        if(seg.stars){
+            seg.simple = false;
+        }
+        if(f[i] == 'h' && f[i+1] == 'h'){
+            seg.length = 'H';
+            i += 2;
+        }else if(f[i] == 'l' && f[i+1] == 'l'){
+            seg.length = 'q';
+            i += 2;
+        }else if(f[i] == 'h' || f[i] == 'l' || f[i] == 'j' || f[i] == 'z' || f[i] == 't' || f[i] == 'L'){
+            seg.length = f[i];
+            ++i;
+        }
+        seg.conversion = f[i];
+        if(f[i] && i + 1 - pos <= maxSpecLength){
+            seg.specLength = static_cast<uint8_t>(i + 1 - pos);
+        }
+        return seg;
+    }
+
+
+    constexpr bool isIntLength(char length){
+        return length != 'L';
+    }
+
+
+    constexpr size_t intLengthSize(char length){
+        return length == 'l' ? sizeof(long)
+            : length == 'q' ? sizeof(long long)
+            : length == 'j' ? sizeof(intmax_t)
+            : length == 'z' ? sizeof(size_t)
+            : length == 't' ? sizeof(ptrdiff_t)
+            : sizeof(int);
+    }
+
+
+    constexpr bool isInt(ArgType arg, char length){
+        return (arg.kind == ArgKind::signedInt || arg.kind == ArgKind::unsignedInt)
+            && isIntLength(length)
+            // smaller types are promoted to int.
+            && (arg.size == intLengthSize(length) || (intLengthSize(length) == sizeof(int) && arg.size < sizeof(int)));
+    }
+
+
+    constexpr bool argMatches(char conversion, char length, ArgType arg){
+        switch(conversion){
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            return isInt(arg, length);
+        case 'c':
+            return length == 0 && isInt(arg, 0);
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            return length == 'L' ? arg.kind == ArgKind::longDouble : (length == 0 && arg.kind == ArgKind::floating);
+        case 's':
+            return length == 0 && arg.kind == ArgKind::string;
+        case 'p':
+            return length == 0 && (arg.kind == ArgKind::pointer || arg.kind == ArgKind::string);
+        default:
+            return false;
+        }
+    }
+
+
+    constexpr bool formatMatches(const char *f, const ArgType *args, size_t nArgs){
+        size_t arg = 0;
+        for(size_t i=0; f[i]; i++){
+            if(f[i] != '%'){
+                continue;
+            }
+            const FormatSegment seg = parseSpec(f, i);
+            if(f[i+1] == '%'){
+                ++i;
+                continue;
+            }
+            if(seg.specLength == 0){
+                return false;
+            }
+            for(size_t s=0; s<seg.stars; s++){
+                if(arg == nArgs || !isInt(args[arg], 0)){
+                    return false;
+                }
+                ++arg;
+            }
+            if(arg == nArgs || !argMatches(seg.conversion, seg.length, args[arg])){
+                return false;
+            }
+            ++arg;
+            i += seg.specLength - 1;
+        }
+        return arg == nArgs;
+    }
+
+
+    template<typename ... Ts>
+    constexpr bool formatMatches(const char *f){
+        const ArgType args[] = {ArgType{ArgKind::other, 0}, argType<Ts>() ...};
+        return formatMatches(f, args + 1, sizeof...(Ts));
+    }
+
+
+    /** @brief Room genericFormat() needs, including the terminator. */
+    inline size_t genericFormatSize(const char *f, size_t nArgs){
+        return 2 * strlen(f) + 8 * nArgs + 8;
+    }
+
+
+    /**
+     * @brief For a format that doesn't match its arguments, e.g. one read from a binary log,
+     * a format that prints it literally followed by each argument by its type, e.g.
+     * "v=%s %d end\n" with one int becomes "v=%%s %%d end [%d]\n".
+     * 
+     * @param dest room for genericFormatSize(f, nArgs) characters.
+     */
+    inline void genericFormat(const char *f, const ArgType *args, size_t nArgs, char *dest){
+        size_t length = strlen(f);
+        const bool newline = length && f[length - 1] == '\n';
+        length -= newline;
+        for(size_t i=0; i<length; i++){
+            if(f[i] == '%'){
+                *dest++ = '%';
+            }
+            *dest++ = f[i];
+        }
+        for(size_t i=0; i<nArgs; i++){
+            const char *conversion;
+            switch(args[i].kind){
+            case ArgKind::signedInt: conversion = args[i].size == sizeof(long long) ? "%lld" : "%d"; break;
+            case ArgKind::unsignedInt: conversion = args[i].size == sizeof(long long) ? "%llu" : "%u"; break;
+            case ArgKind::floating: conversion = "%g"; break;
+            case ArgKind::longDouble: conversion = "%Lg"; break;
+            case ArgKind::string: conversion = "%s"; break;
+            case ArgKind::pointer: conversion = "%p"; break;
+            default: conversion = "?"; break;
+            }
+            const char *separator = i ? ", " : " [";
+            dest = std::copy(separator, separator + 2, dest);
+            dest = std::copy(conversion, conversion + strlen(conversion), dest);
+        }
+        if(nArgs){
+            *dest++ = ']';
+        }
+        if(newline){
+            *dest++ = '\n';
+        }
+        *dest = 0;
+    }
+
+
+    template<bool isFormat, typename Fmt, typename ... Ts>
+    struct FormatCheckImpl : std::true_type{};
+
+    template<typename Fmt, typename ... Ts>
+    struct FormatCheckImpl<true, Fmt, Ts ...> : std::integral_constant<bool, formatMatches<Ts ...>(Fmt::str())>{};
+
+    /**
+     * @brief True unless the first of Ts is a #QUICKLOG_FMT string that doesn't match the rest.
+     */
+    template<typename ... Ts>
+    struct FormatCheck : std::true_type{};
+
+    template<typename First, typename ... Ts>
+    struct FormatCheck<First, Ts ...> : FormatCheckImpl<IsFormatString<First>::value, First, Ts ...>{};
+
+    template<bool isSite, typename Site>
+    struct EntryLevelImpl : std::integral_constant<int, -1>{};
+
+    template<typename Site>
+    struct EntryLevelImpl<true, Site> : std::integral_constant<int, static_cast<int>(Site::level())>{};
+
+    /**
+     * @brief The Level of an entry logged with arguments Ts as an int, or -1 if the first
+     * isn't a #QUICKLOG_SITE.
+     */
+    template<typename ... Ts>
+    struct EntryLevel : std::integral_constant<int, -1>{};
+
+    template<typename First, typename ... Ts>
+    struct EntryLevel<First, Ts ...> : EntryLevelImpl<IsFormatString<First>::value, First>{};
+
+
+    /**
+     * @brief Descriptor of a #QUICKLOG_SITE call site, registered alongside its decoder.
+     */
+    struct SiteInfo{
+        const char *format;
+        const char *file;
+        unsigned line;
+        Level level;
+        uint8_t numArgs;
+        const ArgType *argTypes;
+    };
+
+
+    template<typename ... Ts>
+    struct SiteDescriptor{
+        static const SiteInfo * get(){
+            return nullptr;
+        }
+    };
+
+    template<typename Site, typename ... Ts>
+    struct SiteDescriptor<Site, Ts ...>{
+        static const SiteInfo * get(){
+            return IsFormatString<Site>::value ? &info : nullptr;
+        }
+
+    private:
+        template<typename T, typename std::enable_if<IsFormatString<T>::value, int>::type = 0>
+        static constexpr SiteInfo makeInfo(){
+            return {T::str(), T::file(), T::line(), T::level(), sizeof...(Ts), argTypes + 1};
+        }
+
+        template<typename T, typename std::enable_if<!IsFormatString<T>::value, int>::type = 0>
+        static constexpr SiteInfo makeInfo(){
+            return {nullptr, nullptr, 0, Level::info, 0, nullptr};
+        }
+
+        static_assert(sizeof...(Ts) <= UINT8_MAX, "Too many log() arguments.");
+
+        // argTypes[0] is unused, it keeps the array non-empty.
+        static constexpr ArgType argTypes[sizeof...(Ts) + 1] = {ArgType{ArgKind::other, 0}, argType<Ts>() ...};
+        static constexpr SiteInfo info = makeInfo<Site>();
+    };
+
+    template<typename Site, typename ... Ts>
+    constexpr ArgType SiteDescriptor<Site, Ts ...>::argTypes[sizeof...(Ts) + 1];
+
+    template<typename Site, typename ... Ts>
+    constexpr SiteInfo SiteDescriptor<Site, Ts ...>::info;
+
+
+    /**
+     * @brief Does the work of #QUICKLOG. The format string literal is only there to be
+     * checked, the site already holds it.
+     */
+    template<class Logger, class Site, size_t n, typename ... Ts>
+    void logAtSite(std::true_type, Logger & logger, Site site, const char (&)[n], const Ts & ... vs){
+        logger.log(site, vs ...);
+    }
+
+    /** @brief A #QUICKLOG below #QUICKLOG_MIN_LEVEL, which doesn't instantiate log(). */
+    template<class Logger, class Site, typename ... Ts>
+    void logAtSite(std::false_type, Logger &, Site, const Ts & ...){}
+
+
+    /**
+     * @brief #QUICKLOG_TIMESTAMP() ticks per second, as calibrated by a LogServer. Measured
+     * here, with a short busy wait, if no server has calibrated its clock yet.
+     */
+    inline uint64_t ticksPerSecond(){
+        uint64_t rate = tickRate().load(std::memory_order_relaxed);
+        if(!rate){
+            TimestampClock clock;
+            clock.calibrate();
+            rate = clock.ticksIn(1000000000);
+        }
+        return rate ? rate : 1;
+    }
+
+
+    /** @brief A thread's state for one #QUICKLOG_EVERY_N call site. */
+    struct EveryN{
+        uint64_t skip = 0;
+
+        bool allow(uint64_t n, uint64_t &){
+            if(skip){
+                --skip;
+                return false;
+            }
+            skip = n ? n - 1 : 0;
+            return true;
+        }
+    };
+
+
+    /**
+     * @brief A thread's state for one #QUICKLOG_RATE_LIMITED call site.
+     * 
+     * The bucket is kept as the tick at which it would be empty, which each entry moves
+     * on by interval. An entry is allowed while that's at most a second ahead of now.
+     */
+    struct RateLimit{
+        uint64_t emptyAt = 0;
+        uint64_t interval = 0;
+        uint64_t tolerance = 0;
+        uint64_t perSecond = 0;
+        uint64_t suppressed = 0;
+        uint64_t reportAt = 0;
+
+        bool allow(uint64_t limit, uint64_t & report){
+            if(limit != perSecond){
+                perSecond = limit;
+                interval = limit ? ticksPerSecond() / limit : 0;
+                tolerance = limit ? (limit - 1) * interval : 0;
+            }
+            const uint64_t now = QUICKLOG_TIMESTAMP();
+            if(!limit || emptyAt > now + tolerance){
+                ++suppressed;
+                return false;
+            }
+            emptyAt = (emptyAt > now ? emptyAt : now) + interval;
+            if(suppressed && now >= reportAt){
+                report = suppressed;
+                suppressed = 0;
+                reportAt = now + perSecond * interval;
+            }
+            return true;
+        }
+    };
+
+
+    /** @brief A thread's state for one #QUICKLOG_FIRST_N call site. */
+    struct FirstN{
+        uint64_t calls = 0;
+        uint64_t suppressed = 0;
+        uint64_t reportAt = 0;
+
+        bool allow(uint64_t n, uint64_t & report){
+            if(calls < n){
+                ++calls;
+                return true;
+            }
+            const uint64_t now = QUICKLOG_TIMESTAMP();
+            if(!suppressed++){
+                reportAt = now + ticksPerSecond();
+            }else if(now >= reportAt){
+                report = suppressed;
+                suppressed = 0;
+            }
+            return false;
+        }
+    };
+
+
+    /**
+     * @brief Does the work of #QUICKLOG_EVERY_N and the other limited forms. log logs the
+     * entry at site, evaluating its arguments.
+     * 
+     * Site is a distinct type for each call site, so each one gets its own Limiter per thread.
+     */
+    template<class Limiter, class Logger, class Site, class Log>
+    void logLimited(std::true_type, Logger & logger, Site site, uint64_t limit, Log log){
+        static thread_local Limiter limiter;
+        if(!logger.levelEnabled(Site::level())){
+            return;
+        }
+        uint64_t report = 0;
+        const bool allowed = limiter.allow(limit, report);
+        if(report){
+            logger.log(QUICKLOG_SUPPRESSED(static_cast<unsigned long>(report), Site::file(), Site::line()));
+        }
+        if(allowed){
+            log(site);
+        }
+    }
+
+    template<class Limiter, class Logger, class Site, class Log>
+    void logLimited(std::false_type, Logger &, Site, uint64_t, Log){}
+
+
+    constexpr size_t countPercents(const char *f){
+        size_t n = 0;
+        for(size_t i=0; f[i]; i++){
+            n += f[i] == '%';
+        }
+        return n;
+    }
+
+
+    template<size_t n>
+    struct FormatPlan{
+        FormatSegment segments[n];
+        size_t count;
+    };
+
+
+    /**
+     * @brief Split a format string, already checked by formatMatches(), into segments.
+     * 
+     * @param segments room for countPercents(f) + 1 segments.
+     * @return The number of segments.
+     */
+    constexpr size_t parseFormat(const char *f, FormatSegment *segments){
+        size_t count = 0;
+        size_t literalBegin = 0;
+        size_t i = 0;
+        for(; f[i]; i++){
+            if(f[i] != '%'){
+                continue;
+            }
+            FormatSegment seg = parseSpec(f, i);
+            seg.literalBegin = static_cast<uint16_t>(literalBegin);
+            if(f[i+1] == '%'){
+                // literal up to and including the first %.
+                seg.literalLength = static_cast<uint16_t>(i + 1 - literalBegin);
+                seg.conversion = 0;
+                ++i;
+            }else{
+                seg.literalLength = static_cast<uint16_t>(i - literalBegin);
+                i += seg.specLength - 1;
+            }
+            literalBegin = i + 1;
+            segments[count++] = seg;
+        }
+        segments[count++] = FormatSegment{static_cast<uint16_t>(literalBegin),
+            static_cast<uint16_t>(i - literalBegin), 0, 0, 0, 0, 0, true};
+        return count;
+    }
+
+
+    template<size_t n>
+    constexpr FormatPlan<n> makeFormatPlan(const char *f){
+        FormatPlan<n> plan{};
+        plan.count = parseFormat(f, plan.segments);
+        return plan;
+    }
+
+
+    /**
+     * @brief The format plan of a #QUICKLOG_FMT string, parsed once at compile time.
+     */
+    template<class Fmt>
+    struct SiteFormat{
+        static constexpr size_t maxSegments = countPercents(Fmt::str()) + 1;
+        static constexpr FormatPlan<maxSegments> plan = makeFormatPlan<maxSegments>(Fmt::str());
+    };
+
+    template<class Fmt>
+    constexpr FormatPlan<SiteFormat<Fmt>::maxSegments> SiteFormat<Fmt>::plan;
+
+
+    /**
+     * @brief An argument as seen by formatPlanned(). Integers are stored zero- or
+     * sign-extended and narrowed again according to the conversion's length modifier.
+     */
+    struct FormatArg{
+        union{
+            unsigned long long u;
+            double d;
+            long double ld;
+            const void *p;
+        };
+    };
+
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    void setFormatArg(FormatArg & arg, const T & v){
+        arg.u = static_cast<unsigned long long>(v);
+    }
+
+    template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    void setFormatArg(FormatArg & arg, const T & v){
+        if(std::is_same<T, long double>::value){
+            arg.ld = v;
+        }else{
+            arg.d = v;
+        }
+    }
+
+    template<typename T, typename std::enable_if<std::is_pointer<T>::value, int>::type = 0>
+    void setFormatArg(FormatArg & arg, const T & v){
+        arg.p = v;
+    }
+
+    inline void setFormatArg(FormatArg & arg, std::nullptr_t){
+        arg.p = nullptr;
+    }
+
+
+    /**
+     * @brief Call format(char *dest, size_t size), which behaves like snprintf, on out's free
+     * space, flushing out first if it doesn't fit.
+     * 
+     * Output too big for an empty OutputBuffer is truncated.
+     */
+    template<class F>
+    void formatInto(OutputBuffer & out, F format){
+        while(true){
+            const size_t available = out.available();
+            const int n = format(out.pos(), available);
+            if(n < 0){
+                return;
+            }
+            if(static_cast<size_t>(n) < available){
+                out.advance(n);
+                return;
+            }
+            if(out.isEmpty()){
+                out.advance(available - 1);
+                return;
+            }
+            out.flush();
+        }
+    }
+
+
+    template<typename T>
+    void formatSpec(OutputBuffer & out, const char *spec, const FormatArg *stars, uint8_t nStars, T v){
+        formatInto(out, [&](char *dest, size_t size){
+            switch(nStars){
+            case 0:
+                return snprintf(dest, size, spec, v);
+            case 1:
+                return snprintf(dest, size, spec, static_cast<int>(stars[0].u), v);
+            default:
+                return snprintf(dest, size, spec, static_cast<int>(stars[0].u), static_cast<int>(stars[1].u), v);
+            }
+        });
+    }
+
+
+    inline long long signedArg(unsigned long long u, char length){
+        switch(length){
+        case 'H': return static_cast<signed char>(u);
+        case 'h': return static_cast<short>(u);
+        case 'l': return static_cast<long>(u);
+        case 'q': return static_cast<long long>(u);
+        case 'j': return static_cast<intmax_t>(u);
+        case 'z': return static_cast<std::make_signed<size_t>::type>(u);
+        case 't': return static_cast<ptrdiff_t>(u);
+        default: return static_cast<int>(u);
+        }
+    }
+
+
+    inline unsigned long long unsignedArg(unsigned long long u, char length){
+        switch(length){
+        case 'H': return static_cast<unsigned char>(u);
+        case 'h': return static_cast<unsigned short>(u);
+        case 'l': return static_cast<unsigned long>(u);
+        case 'q': return static_cast<unsigned long long>(u);
+        case 'j': return static_cast<uintmax_t>(u);
+        case 'z': return static_cast<size_t>(u);
+        case 't': return static_cast<std::make_unsigned<ptrdiff_t>::type>(u);
+        default: return static_cast<unsigned>(u);
+        }
+    }
+
+
+    inline void writeUnsigned(OutputBuffer & out, unsigned long long v, unsigned base, bool upper, bool negative){
+        const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+        char buffer[24];
+        char *p = buffer + sizeof(buffer);
+        do{
+            *--p = digits[v % base];
+            v /= base;
+        }while(v);
+        if(negative){
+            *--p = '-';
+        }
+        out.write(p, buffer + sizeof(buffer) - p);
+    }
+
+
+    /**
+     * @brief Write ns, nanoseconds since the epoch, as <tt>seconds.nanoseconds </tt>.
+     */
+    inline void writeTimestamp(OutputBuffer & out, uint64_t ns){
+        char buffer[32];
+        char *p = buffer + sizeof(buffer);
+        *--p = ' ';
+        uint64_t fraction = ns % 1000000000;
+        for(int i=0; i<9; i++){
+            *--p = '0' + fraction % 10;
+            fraction /= 10;
+        }
+        *--p = '.';
+        uint64_t seconds = ns / 1000000000;
+        do{
+            *--p = '0' + seconds % 10;
+            seconds /= 10;
+        }while(seconds);
+        out.write(p, buffer + sizeof(buffer) - p);
+    }
+
+
+    /**
+     * @brief Format one conversion. Simple %d, %u, %x, %s and %c are handled directly,
+     * everything else goes to snprintf with just this conversion's specification.
+     */
+    inline void formatConversion(OutputBuffer & out, const char *fmt, const FormatSegment & seg, const FormatArg *args){
+        const FormatArg & arg = args[seg.stars];
+        if(seg.simple){
+            switch(seg.conversion){
+            case 'd': case 'i':{
+                const long long v = signedArg(arg.u, seg.length);
+                writeUnsigned(out, v < 0 ? 0ull - static_cast<unsigned long long>(v) : v, 10, false, v < 0);
+                return;
+            }
+            case 'u':
+                writeUnsigned(out, unsignedArg(arg.u, seg.length), 10, false, false);
+                return;
+            case 'x': case 'X':
+                writeUnsigned(out, unsignedArg(arg.u, seg.length), 16, seg.conversion == 'X', false);
+                return;
+            case 's':{
+                const char *s = arg.p ? static_cast<const char*>(arg.p) : "(null)";
+                out.write(s, strlen(s));
+                return;
+            }
+            case 'c':{
+                const char c = static_cast<char>(arg.u);
+                out.write(&c, 1);
+                return;
+            }
+            }
+        }
+
+        char spec[maxSpecLength + 1];
+        memcpy(spec, fmt + seg.specBegin, seg.specLength);
+        spec[seg.specLength] = 0;
+
+        switch(seg.conversion){
+        case 'd': case 'i':
+            switch(seg.length){
+            case 'l': formatSpec(out, spec, args, seg.stars, static_cast<long>(arg.u)); return;
+            case 'q': formatSpec(out, spec, args, seg.stars, static_cast<long long>(arg.u)); return;
+            case 'j': formatSpec(out, spec, args, seg.stars, static_cast<intmax_t>(arg.u)); return;
+            case 'z': formatSpec(out, spec, args, seg.stars, static_cast<std::make_signed<size_t>::type>(arg.u)); return;
+            case 't': formatSpec(out, spec, args, seg.stars, static_cast<ptrdiff_t>(arg.u)); return;
+            default: formatSpec(out, spec, args, seg.stars, static_cast<int>(arg.u)); return;
+            }
+        case 'o': case 'u': case 'x': case 'X':
+            switch(seg.length){
+            case 'l': formatSpec(out, spec, args, seg.stars, static_cast<unsigned long>(arg.u)); return;
+            case 'q': formatSpec(out, spec, args, seg.stars, static_cast<unsigned long long>(arg.u)); return;
+            case 'j': formatSpec(out, spec, args, seg.stars, static_cast<uintmax_t>(arg.u)); return;
+            case 'z': formatSpec(out, spec, args, seg.stars, static_cast<size_t>(arg.u)); return;
+            case 't': formatSpec(out, spec, args, seg.stars, static_cast<std::make_unsigned<ptrdiff_t>::type>(arg.u)); return;
+            default: formatSpec(out, spec, args, seg.stars, static_cast<unsigned>(arg.u)); return;
+            }
+        case 'c':
+            formatSpec(out, spec, args, seg.stars, static_cast<int>(arg.u));
+            return;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            if(seg.length == 'L'){
+                formatSpec(out, spec, args, seg.stars, arg.ld);
+            }else{
+                formatSpec(out, spec, args, seg.stars, arg.d);
+            }
+            return;
+        case 's':
+            formatSpec(out, spec, args, seg.stars, static_cast<const char*>(arg.p));
+            return;
+        case 'p':
+            formatSpec(out, spec, args, seg.stars, arg.p);
+            return;
+        }
+    }
+
+
+    /**
+     * @brief Format args into out following a plan from makeFormatPlan().
+     */
+    inline void formatPlanned(OutputBuffer & out, const char *fmt, const FormatSegment *segments, size_t count,
+        const FormatArg *args)
+    {
+        for(size_t i=0; i<count; i++){
+            const FormatSegment & seg = segments[i];
+            out.write(fmt + seg.literalBegin, seg.literalLength);
+            if(seg.conversion){
+                formatConversion(out, fmt, seg, args);
+                args += seg.stars + 1;
+            }
+        }
+    }
+
+
+    template<typename Tuple, size_t ... I>
+    auto callPrintFunc(const Tuple & t, std::index_sequence<I ...>){
+        return QUICKLOG_PRINT(presentArg(std::get<I>(t)) ...);
+    }
+
+
+    template<typename Tuple>
+    auto callPrintFunc(const Tuple & t){
+        constexpr auto size = std::tuple_size<Tuple>::value;
+        return callPrintFunc(t, std::make_index_sequence<size>{});
+    }
+
+
+    /**
+     * @brief Format t into out with #QUICKLOG_FORMAT, flushing out first if it doesn't fit.
+     * 
+     * Entries too big for an empty OutputBuffer are truncated.
+     */
+    template<typename Tuple, size_t ... I>
+    void callFormatFunc(const Tuple & t, OutputBuffer & out, std::index_sequence<I ...>){
+#ifdef QUICKLOG_FORMAT
+        formatInto(out, [&](char *dest, size_t size){
+            return QUICKLOG_FORMAT(dest, size, presentArg(std::get<I>(t)) ...);
+        });
+#else
+        (void)t; (void)out;
+        QUICKLOG_ERROR("QUICKLOG_FORMAT must be defined to use a buffered sink.\n");
+#endif
+    }
+
+
+    /**
+     * @brief Format a tuple starting with a #QUICKLOG_FMT string using its precompiled plan.
+     */
+    template<typename Tuple, size_t ... I>
+    void callPlannedFormat(const Tuple & t, OutputBuffer & out, std::index_sequence<0, I ...>){
+        typedef typename std::decay<typename std::tuple_element<0, Tuple>::type>::type Fmt;
+        typedef SiteFormat<Fmt> Site;
+        // args[0] is unused, it keeps the arrays non-empty.
+        FormatArg args[sizeof...(I) + 1];
+        const int expand[] = {0, (setFormatArg(args[I], presentArg(std::get<I>(t))), 0) ...};
+        (void)expand;
+        formatPlanned(out, Fmt::str(), Site::plan.segments, Site::plan.count, args + 1);
+    }
+
+
+    template<typename Tuple>
+    void callFormatFunc(const Tuple & t, OutputBuffer & out, std::false_type){
+        constexpr auto size = std::tuple_size<Tuple>::value;
+        callFormatFunc(t, out, std::make_index_sequence<size>{});
+    }
+
+
+    template<typename Tuple>
+    void callFormatFunc(const Tuple & t, OutputBuffer & out, std::true_type){
+        constexpr auto size = std::tuple_size<Tuple>::value;
+        callPlannedFormat(t, out, std::make_index_sequence<size>{});
+    }
+
+
+    template<typename Tuple>
+    struct StartsWithFormatString : std::false_type{};
+
+    template<typename First, typename ... Ts>
+    struct StartsWithFormatString<std::tuple<First, Ts ...>> : IsFormatString<typename std::decay<First>::type>{};
+
+
+    template<typename Tuple>
+    void callFormatFunc(const Tuple & t, OutputBuffer & out){
+        callFormatFunc(t, out, StartsWithFormatString<Tuple>{});
+    }
+
+
+    /**
+     * @brief The binary log format written by BinarySink and read by quicklog_decode.
+     * 
+     * All values are in host byte order. The file starts with
+     * <tt>char magic[4]; uint16_t version; uint16_t byteOrder; uint32_t flags;</tt>,
+     * byteOrder being 0x0102 as written by the host, followed by frames each starting
+     * with a uint8_t BinaryFrame. If flags has binary::timestampFlag, entry and text
+     * frames start with a <tt>uint64_t</tt> timestamp in nanoseconds since the epoch.
+     * 
+     * - dictionary: <tt>uint16_t site; uint32_t line; uint8_t level; uint8_t numArgs;</tt>
+     *   numArgs pairs of <tt>uint8_t kind; uint8_t size;</tt> (ArgKind and sizeof), then
+     *   the file and the format as <tt>uint32_t length;</tt> followed by the characters.
+     *   Precedes the first entry of each site.
+     * - entry: <tt>uint16_t site;</tt>, the timestamp, then each argument. Strings are a
+     *   <tt>uint32_t length;</tt> and the characters, or just binary::nullString if null.
+     *   Everything else is its sizeof bytes.
+     * - text: the timestamp, then an entry not logged via #QUICKLOG_SITE formatted
+     *   with #QUICKLOG_FORMAT, terminated by a 0.
+     */
+    namespace binary{
+        constexpr char magic[4] = {'Q', 'L', 'O', 'G'};
+        constexpr uint16_t version = 2;
+        constexpr uint16_t byteOrder = 0x0102;
+        constexpr uint32_t timestampFlag = 1;
+        constexpr uint32_t nullString = UINT32_MAX;
+    }
+
+
+    enum class BinaryFrame : uint8_t{
+        dictionary = 'D',
+        entry = 'E',
+        text = 'T'
+    };
+
+
+    template<typename T>
+    void writeValue(OutputBuffer & out, const T & v){
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+
+    inline void writeString(OutputBuffer & out, const char *str){
+        if(!str){
+            writeValue(out, binary::nullString);
+            return;
+        }
+        const uint32_t length = static_cast<uint32_t>(strlen(str));
+        writeValue(out, length);
+        out.write(str, length);
+    }
+
+
+    /**
+     * @brief Start a frame, writing the file header first if this is the first one.
+     */
+    inline void beginFrame(OutputBuffer & out, BinaryFrame frame){
+        BinaryState & state = *out.binary();
+        if(!state.headerWritten){
+            out.write(binary::magic, sizeof(binary::magic));
+            writeValue(out, binary::version);
+            writeValue(out, binary::byteOrder);
+            writeValue(out, static_cast<uint32_t>(QUICKLOG_TIMESTAMPS ? binary::timestampFlag : 0));
+            state.headerWritten = true;
+        }
+        writeValue(out, frame);
+    }
+
+
+    inline void writeDictionary(OutputBuffer & out, uint16_t id, const SiteInfo & site){
+        beginFrame(out, BinaryFrame::dictionary);
+        writeValue(out, id);
+        writeValue(out, static_cast<uint32_t>(site.line));
+        writeValue(out, site.level);
+        writeValue(out, site.numArgs);
+        for(size_t i=0; i<site.numArgs; i++){
+            writeValue(out, site.argTypes[i].kind);
+            writeValue(out, site.argTypes[i].size);
+        }
+        writeString(out, site.file);
+        writeString(out, site.format);
+    }
+
+
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    void writeArg(OutputBuffer & out, const T & v){
+        writeValue(out, v);
+    }
+
+    template<typename T, typename std::enable_if<argType<T>().kind == ArgKind::string, int>::type = 0>
+    void writeArg(OutputBuffer & out, const T & v){
+        writeString(out, v);
+    }
+
+    template<typename T, typename std::enable_if<argType<T>().kind == ArgKind::pointer, int>::type = 0>
+    void writeArg(OutputBuffer & out, const T & v){
+        writeValue(out, static_cast<const void*>(v));
+    }
+
+
+    template<typename Tuple, size_t ... I>
+    void writeEntry(const Tuple & t, OutputBuffer & out, uint16_t id, uint64_t ns, std::index_sequence<0, I ...>){
+        beginFrame(out, BinaryFrame::entry);
+        writeValue(out, id);
+        if(QUICKLOG_TIMESTAMPS){
+            writeValue(out, ns);
+        }
+        const int expand[] = {0, (writeArg(out, presentArg(std::get<I>(t))), 0) ...};
+        (void)expand;
+    }
+
+
+    template<typename Tuple>
+    void writeBinary(const Tuple & t, OutputBuffer & out, uint16_t id, uint64_t ns, const SiteInfo *site, std::true_type){
+        bool & described = out.binary()->described[id];
+        if(!described){
+            writeDictionary(out, id, *site);
+            described = true;
+        }
+        writeEntry(t, out, id, ns, std::make_index_sequence<std::tuple_size<Tuple>::value>{});
+    }
+
+    inline void writeUnformatted(OutputBuffer & out, const char *format){
+        out.write(format, strlen(format));
+    }
+
+    template<typename T>
+    void writeUnformatted(OutputBuffer &, const T &){}
+
+    template<typename Tuple>
+    void writeUnformatted(const Tuple & t, OutputBuffer & out, std::true_type){
+        writeUnformatted(out, presentArg(std::get<0>(t)));
+    }
+
+    template<typename Tuple>
+    void writeUnformatted(const Tuple &, OutputBuffer &, std::false_type){}
+
+    template<typename Tuple>
+    void writeBinary(const Tuple & t, OutputBuffer & out, uint16_t, uint64_t ns, const SiteInfo *, std::false_type){
+        beginFrame(out, BinaryFrame::text);
+        if(QUICKLOG_TIMESTAMPS){
+            writeValue(out, ns);
+        }
+        if(out.binary()->signalSafe){
+            // formatting isn't async-signal-safe, so just the format string.
+            writeUnformatted(t, out, std::integral_constant<bool, (std::tuple_size<Tuple>::value > 0)>{});
+        }else{
+            callFormatFunc(t, out);
+        }
+        out.write("", 1);
+    }
+
+
+    /**
+     * @brief Print t with #QUICKLOG_PRINT, or format it into out if there is one, or
+     * write it in the binary format if out is binary.
+     * 
+     * @param id t's decoder index.
+     * @param ns t's timestamp if #QUICKLOG_TIMESTAMPS is set.
+     * @param site t's call site, if it has one.
+     */
+    template<typename Tuple>
+    void output(const Tuple & t, OutputBuffer * out, uint16_t id, uint64_t ns, const SiteInfo *site){
+        if(!out){
+            if(QUICKLOG_TIMESTAMPS){
+                QUICKLOG_PRINT_TIMESTAMP(static_cast<unsigned long long>(ns / 1000000000),
+                    static_cast<unsigned long long>(ns % 1000000000));
+            }
+            callPrintFunc(t);
+        }else if(out->binary()){
+            writeBinary(t, *out, id, ns, site, StartsWithFormatString<Tuple>{});
+        }else{
+            if(QUICKLOG_TIMESTAMPS){
+                writeTimestamp(*out, ns);
+            }
+            callFormatFunc(t, *out);
+        }
+    }
+
+
+    /**
+     * @brief Round sz up to size required for alignment.
+     * 
+     * @param sz 
+     * @param align
+     * @return constexpr size_t 
+     */
+    constexpr size_t alignedSize(size_t sz, size_t align = QUICKLOG_ALIGN){
+        return (sz % align) ? sz + (align - sz % align) : sz;
+    }
+
+
+
+    /**
+     * @brief Header written by EntryBuffer::pushEntry() in front of every record.
+     * 
+     * decoder is an index into decoderTable(), size is the size of the whole record
+     * (header, padding and payload) in bytes.
+     */
+    struct RecordHeader{
+        uint16_t decoder;
+        uint16_t size;
+    };
+
+
+    /** @brief Size of the #QUICKLOG_TIMESTAMP() ticks following a LogEntry's RecordHeader, if any. */
+    constexpr size_t timestampSize = QUICKLOG_TIMESTAMPS ? sizeof(uint64_t) : 0;
+
+
+    typedef void (*DecodeFunc)(const uint8_t *record, OutputBuffer *out, const TimestampClock & clock);
+
+
+    /** @brief The #QUICKLOG_TIMESTAMP() ticks of a LogEntry record. Requires #QUICKLOG_TIMESTAMPS. */
+    inline uint64_t recordTicks(const uint8_t *record){
+        uint64_t ticks = 0;
+        memcpy(&ticks, record + sizeof(RecordHeader), timestampSize);
+        return ticks;
+    }
+
+
+    /**
+     * @brief How an argument is kept in a record's payload. See RecordLayout.
+     */
+    enum class ArgStorage : uint8_t{
+        // the argument's sizeof bytes.
+        value,
+        // a pointer to a null terminated string.
+        string,
+        // CopiedBytes of a null terminated string, see Str.
+        copiedString,
+        // CopiedBytes printed as hex digits, see Bytes and serializer.
+        copiedBytes,
+        // nothing to print, e.g. a #QUICKLOG_FMT string.
+        none
+    };
+
+    template<typename T>
+    constexpr ArgStorage argStorage(){
+        return IsFormatString<T>::value ? ArgStorage::none
+            : std::is_same<T, Str>::value ? ArgStorage::copiedString
+            : std::is_same<T, Bytes>::value || HasSerializer<T>::value ? ArgStorage::copiedBytes
+            : argType<T>().kind == ArgKind::string ? ArgStorage::string
+            : argType<T>().kind == ArgKind::other ? ArgStorage::none
+            : ArgStorage::value;
+    }
+
+    /** @brief Where an argument is in a record's payload. */
+    struct CrashArg{
+        uint16_t offset;
+        ArgType type;
+        ArgStorage storage;
+    };
+
+    static_assert(sizeof(CrashArg) == 6, "quicklog_core.py expects 6 byte CrashArgs.");
+
+    /**
+     * @brief Where the arguments are in the records of one entry type, registered with its
+     * decoder for quicklog_core.py.
+     */
+    struct RecordLayout{
+        enum Placement : uint8_t{
+            // at the first multiple of payloadAlign after the header, in memory.
+            natural,
+            // at the first multiple of payloadAlign after the header, from the record's start.
+            inPlace,
+            // straight after the header.
+            packed
+        };
+
+        Placement placement;
+        uint8_t payloadAlign;
+        uint8_t numArgs;
+        const CrashArg *args;
+    };
+
+
+    /**
+     * @brief Jump table used by the server to decode records.
+     * 
+     * Records carry an index into this table instead of a vtable pointer.
+     */
+    class DecoderTable{
+        static_assert(QUICKLOG_MAX_ENTRY_TYPES < UINT16_MAX, "QUICKLOG_MAX_ENTRY_TYPES must fit in a decoder id.");
+
+    public:
+        /** @brief The id add() returns once the table is full. Its records are skipped. */
+        static constexpr uint16_t overflowId = QUICKLOG_MAX_ENTRY_TYPES;
+
+        DecoderTable(){
+            funcs[overflowId] = &skip;
+            sites[overflowId] = nullptr;
+            layouts[overflowId] = nullptr;
+        }
+
+        uint16_t add(DecodeFunc func, const SiteInfo *site = nullptr, const RecordLayout *layout = nullptr){
+            uint16_t id = count.load(std::memory_order_relaxed);
+            do{
+                if(id >= QUICKLOG_MAX_ENTRY_TYPES){
+                    // in case QUICKLOG_ERROR returns.
+                    QUICKLOG_ERROR("More than QUICKLOG_MAX_ENTRY_TYPES entry types.\n");
+                    return overflowId;
+                }
+            }while(!count.compare_exchange_weak(id, id + 1));
+            funcs[id] = func;
+            sites[id] = site;
+            layouts[id] = layout;
+            return id;
+        }
+
+        DecodeFunc operator[](uint16_t id) const{
+            return funcs[id];
+        }
+
+        /**
+         * @brief The call site registered with a decoder, or nullptr if it wasn't
+         * logged via #QUICKLOG_SITE.
+         */
+        const SiteInfo * site(uint16_t id) const{
+            return sites[id];
+        }
+
+        /** @brief Where the arguments are in records of a decoder, or nullptr for padding. */
+        const RecordLayout * layout(uint16_t id) const{
+            return layouts[id];
+        }
+
+    private:
+        static void skip(const uint8_t *, OutputBuffer *, const TimestampClock &){}
+
+        // the layout quicklog_core.py expects, see crash.
+        char magic[16] = "quicklog-table ";
+        uint16_t headerSize = sizeof(RecordHeader) + timestampSize;
+        std::atomic<uint16_t> count{0};
+        // including overflowId.
+        uint32_t maxTypes = QUICKLOG_MAX_ENTRY_TYPES + 1;
+        DecodeFunc funcs[QUICKLOG_MAX_ENTRY_TYPES + 1];
+        const SiteInfo *sites[QUICKLOG_MAX_ENTRY_TYPES + 1];
+        const RecordLayout *layouts[QUICKLOG_MAX_ENTRY_TYPES + 1];
+    };
+
+
+    inline DecoderTable & decoderTable(){
+        static DecoderTable table;
+        return table;
+    }
+
+
+    constexpr size_t sumOf(std::initializer_list<size_t> values){
+        size_t sum = 0;
+        for(size_t v : values){
+            sum += v;
+        }
+        return sum;
+    }
+
+
+    template<typename ... Ts>
+    constexpr bool allTriviallyCopyable(){
+        const bool values[] = {true, std::is_trivially_copyable<Ts>::value ...};
+        for(bool v : values){
+            if(!v){
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Record layout and decoding for one argument type list.
+     * 
+     * Records are placed according to AlignPolicy. If the policy doesn't leave
+     * the payload suitably aligned it is memcpy'd in and out of the buffer.
+     * Data copied by arguments such as Str follows the payload, see ArgTraits.
+     * 
+     * Positions passed to payloadOffset() and size() are the record's offset from
+     * any QUICKLOG_ALIGN aligned address.
+     */
+    template<class AlignPolicy, typename ... Ts>
+    class LogEntry{
+    public:
+        typedef std::tuple<typename ArgTraits<Ts>::Stored ...> Payload;
+
+        static_assert(alignof(Payload) <= QUICKLOG_ALIGN, "Over-aligned log() arguments are not supported.");
+
+        static constexpr bool inPlace = AlignPolicy::natural || alignof(Payload) <= AlignPolicy::recordAlign;
+
+        static_assert(inPlace || allTriviallyCopyable<typename ArgTraits<Ts>::Stored ...>(),
+            "Packed records require trivially copyable log() arguments.");
+
+        static constexpr size_t headerSize = sizeof(RecordHeader) + timestampSize;
+
+        /** @brief Upper bound of copySize(). */
+        static constexpr size_t maxCopy = sumOf({size_t(0), ArgTraits<Ts>::maxCopy ...});
+
+        static_assert(headerSize + QUICKLOG_ALIGN + sizeof(Payload) + maxCopy <= UINT16_MAX, "Log entry too big.");
+
+        /** @brief Bytes copied after the payload by arguments such as Str. */
+        static size_t copySize(const Ts & ... args){
+            return sumOf({size_t(0), ArgTraits<Ts>::copySize(args) ...});
+        }
+
+        static constexpr size_t payloadOffset(size_t pos){
+            return AlignPolicy::natural ? alignedSize(pos + headerSize, alignof(Payload)) - pos
+                : inPlace ? alignedSize(headerSize, alignof(Payload))
+                : headerSize;
+        }
+
+        static constexpr size_t size(size_t pos, size_t copied = 0){
+            return alignedSize(payloadOffset(pos) + sizeof(Payload) + copied, AlignPolicy::recordAlign);
+        }
+
+        /** @brief Upper bound of size() over all positions. */
+        static constexpr size_t maxSize = alignedSize(headerSize + alignof(Payload) - 1 + sizeof(Payload) + maxCopy,
+            AlignPolicy::recordAlign);
+
+        /**
+         * @brief Index of this entry type in decoderTable(). Registered on first use.
+         * 
+         * For #QUICKLOG_SITE entries this is the site ID.
+         */
+        static uint16_t decoder(){
+            static const uint16_t id = decoderTable().add(&decode, SiteDescriptor<Ts ...>::get(), layout());
+            return id;
+        }
+
+        static const RecordLayout * layout(){
+            // args[0] is unused, it keeps the array non-empty.
+            static CrashArg args[sizeof...(Ts) + 1];
+            static const RecordLayout layout = describe(args + 1, std::index_sequence_for<Ts ...>{});
+            return &layout;
+        }
+
+        /**
+         * @param entrySize size(pos, copySize(args ...))
+         */
+        static void write(uint8_t *dest, size_t pos, size_t entrySize, const Ts & ... args){
+            RecordHeader header = {decoder(), static_cast<uint16_t>(entrySize)};
+            memcpy(dest, &header, sizeof(header));
+            if(QUICKLOG_TIMESTAMPS){
+                const uint64_t ticks = QUICKLOG_TIMESTAMP();
+                memcpy(dest + sizeof(header), &ticks, timestampSize);
+            }
+            size_t copyOffset = payloadOffset(pos) + sizeof(Payload);
+            (void)copyOffset;
+            // braced so that the copies are made in order.
+            if(inPlace){
+                new (dest + payloadOffset(pos)) Payload{ArgTraits<Ts>::store(args, dest, copyOffset) ...};
+            }else{
+                Payload payload{ArgTraits<Ts>::store(args, dest, copyOffset) ...};
+                memcpy(dest + payloadOffset(pos), &payload, sizeof(payload));
+            }
+        }
+
+    private:
+        static void decode(const uint8_t *record, OutputBuffer *out, const TimestampClock & clock){
+            uint64_t ns = 0;
+            if(QUICKLOG_TIMESTAMPS){
+                ns = clock.toNanoseconds(recordTicks(record));
+            }
+            const uint8_t *src = record + payloadOffset(reinterpret_cast<uintptr_t>(record));
+            if(inPlace){
+                load(*reinterpret_cast<const Payload*>(src), record, out, ns, std::index_sequence_for<Ts ...>{});
+            }else{
+                alignas(Payload) uint8_t payload[sizeof(Payload)];
+                memcpy(payload, src, sizeof(payload));
+                load(*reinterpret_cast<const Payload*>(payload), record, out, ns, std::index_sequence_for<Ts ...>{});
+            }
+        }
+
+        template<size_t ... I>
+        static RecordLayout describe(CrashArg *args, std::index_sequence<I ...>){
+            // only the addresses of the elements are taken.
+            alignas(Payload) static uint8_t storage[sizeof(Payload)];
+            const Payload & payload = *reinterpret_cast<const Payload*>(storage);
+            const int expand[] = {0, (args[I] = CrashArg{
+                static_cast<uint16_t>(reinterpret_cast<const uint8_t*>(&std::get<I>(payload)) - storage),
+                argType<Ts>(), argStorage<Ts>()}, 0) ...};
+            (void)expand;
+            (void)payload;
+            return RecordLayout{
+                AlignPolicy::natural ? RecordLayout::natural : inPlace ? RecordLayout::inPlace : RecordLayout::packed,
+                static_cast<uint8_t>(alignof(Payload)), static_cast<uint8_t>(sizeof...(Ts)), args};
+        }
+
+        template<size_t ... I>
+        static void load(const Payload & payload, const uint8_t *record, OutputBuffer *out, uint64_t ns,
+            std::index_sequence<I ...>)
+        {
+            (void)record;
+            const bool signalSafe = out && out->binary() && out->binary()->signalSafe;
+            (void)signalSafe;
+            const std::tuple<typename ArgTraits<Ts>::Loaded ...> args(loadArg<Ts>(std::get<I>(payload), record, signalSafe) ...);
+            output(args, out, decoder(), ns, SiteDescriptor<Ts ...>::get());
+        }
+    };
+
+
+    /**
+     * @brief Record that prints nothing. Used to skip over the end of a RingLocalLogger's ring.
+     */
+    class PaddingEntry{
+    public:
+        static uint16_t decoder(){
+            static const uint16_t id = decoderTable().add(&decode);
+            return id;
+        }
+
+        static void write(uint8_t *dest, size_t size){
+            RecordHeader header = {decoder(), static_cast<uint16_t>(size)};
+            memcpy(dest, &header, sizeof(header));
+        }
+
+    private:
+        static void decode(const uint8_t *, OutputBuffer *, const TimestampClock &){}
+    };
+
+
+    /** @brief The bytes of an EntryBuffer, inside it. */
+    template<size_t size>
+    struct EntryBufferData{
+        uint8_t * data(){
+            return m_data;
+        }
+
+        const uint8_t * data() const{
+            return m_data;
+        }
+
+        static constexpr size_t capacity(){
+            return size;
+        }
+
+        uint8_t m_data[size] alignas(QUICKLOG_ALIGN);
+    };
+
+    /** @brief The bytes of a LocalLogger<dynamic, dynamic> EntryBuffer, which it's given. */
+    template<>
+    struct EntryBufferData<dynamic>{
+        uint8_t * data(){
+            return m_data;
+        }
+
+        const uint8_t * data() const{
+            return m_data;
+        }
+
+        size_t capacity() const{
+            return m_size;
+        }
+
+        uint8_t *m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    template <size_t size, class AlignPolicy>
+    class EntryBuffer{
+    public:
+
+        /** @return The size of the record written, or 0 if it doesn't fit. */
+        template<typename ...Ts>
+        size_t pushEntry(const Ts & ... vs){
+            typedef LogEntry<AlignPolicy, Ts ...> Entry;
+
+            const size_t entrySize = Entry::size(m_pos, Entry::copySize(vs ...));
+            if(entrySize + m_pos > m_data.capacity()){
+                return 0;
+            }
+
+            Entry::write(&m_data.data()[m_pos], m_pos, entrySize, vs ...);
+
+            m_pos += entrySize;
+            m_count ++;
+            m_published.store(m_pos, std::memory_order_release);
+            return entrySize;
+        }
+
+        void clear(){
+            m_count = 0;
+            m_pos = 0;
+            m_published.store(0, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief How many bytes of whole records there are, for the server to read while the
+         * producer is still writing the buffer. See LogServer::autoFlush().
+         */
+        size_t published() const{
+            return m_published.load(std::memory_order_acquire);
+        }
+
+        bool isEmpty(){
+            return m_pos == 0;
+        }
+
+        size_t count(){
+            return m_count;
+        }
+
+        const uint8_t * record(size_t pos) const{
+            return &m_data.data()[pos];
+        }
+
+        /** @brief Decode n records starting at pos, leaving the buffer as it is. */
+        void dumpRecords(OutputBuffer *out, const TimestampClock & clock, size_t pos, size_t n) const{
+            const DecoderTable & decoders = decoderTable();
+            for(size_t i=0; i<n; i++){
+                RecordHeader header;
+                memcpy(&header, &m_data.data()[pos], sizeof(header));
+                decoders[header.decoder](&m_data.data()[pos], out, clock);
+                pos += header.size;
+            }
+        }
+
+        /**
+         * @brief Decode the records from pos up to end, leaving the buffer as it is.
+         * 
+         * @return The number of records.
+         */
+        size_t dumpRange(OutputBuffer *out, const TimestampClock & clock, size_t pos, size_t end) const{
+            const DecoderTable & decoders = decoderTable();
+            size_t n = 0;
+            for(; pos < end; n++){
+                RecordHeader header;
+                memcpy(&header, &m_data.data()[pos], sizeof(header));
+                decoders[header.decoder](&m_data.data()[pos], out, clock);
+                pos += header.size;
+            }
+            return n;
+        }
+
+        void describe(CrashDescriptor & crash, size_t field) const{
+            crash.set(field, &m_count);
+            crash.set(field + 1, &m_pos);
+            crash.set(field + 2, m_data.data());
+        }
+
+        /** @brief Where the bytes are, for size dynamic. */
+        void setData(uint8_t *data, size_t capacity){
+            m_data.m_data = data;
+            m_data.m_size = capacity;
+        }
+
+    private:
+        size_t m_count = 0;
+        size_t m_pos = 0;
+        std::atomic<size_t> m_published{0};
+        EntryBufferData<size> m_data;
+    };
+
+
+    /**
+     * @brief A LocalLogger's buffers, inside the logger.
+     */
+    template<size_t numBuffers, size_t bufferSize, class AlignPolicy>
+    class LoggerBuffers{
+        static_assert(numBuffers > 0 && numBuffers <= UINT32_MAX, "numBuffers must be between 1 and 2^32 - 1.");
+
+    public:
+        typedef EntryBuffer<bufferSize, AlignPolicy> Buffer;
+
+        Buffer & operator[](size_t i){
+            return m_buffers[i];
+        }
+
+        /** @brief Entries reported dropped in buffer i, for LocalLogger::overwriteOldest(). */
+        unsigned long & reportedDrops(size_t i){
+            return m_reportedDrops[i];
+        }
+
+        static constexpr size_t size(){
+            return numBuffers;
+        }
+
+        /** @brief i modulo size(). A mask when that's a power of two. */
+        static constexpr size_t wrap(size_t i){
+            return i % numBuffers;
+        }
+
+        /** @brief Bytes from one buffer to the next. */
+        static constexpr size_t stride(){
+            return sizeof(Buffer);
+        }
+
+    private:
+        Buffer m_buffers[numBuffers];
+        unsigned long m_reportedDrops[numBuffers] = {};
+    };
+
+    /**
+     * @brief The buffers of a LocalLogger<dynamic, dynamic>, allocated in one piece when
+     * it's constructed.
+     * 
+     * Each buffer is a cache line holding its EntryBuffer, followed by its bytes.
+     */
+    template<class AlignPolicy>
+    class LoggerBuffers<dynamic, dynamic, AlignPolicy>{
+    public:
+        typedef EntryBuffer<dynamic, AlignPolicy> Buffer;
+
+        template<class Allocator>
+        LoggerBuffers(size_t numBuffers, size_t bufferSize, Allocator & allocator):
+            m_mask(numBuffers - 1),
+            m_stride(headerSize + (bufferSize + QUICKLOG_ALIGN - 1) / QUICKLOG_ALIGN * QUICKLOG_ALIGN),
+            m_allocator(&allocator),
+            m_free(&deallocate<Allocator>)
+        {
+            if(numBuffers == 0 || (numBuffers & m_mask) || numBuffers > UINT32_MAX){
+                QUICKLOG_ERROR("LocalLogger numBuffers must be a power of two below 2^32.\n");
+                return;
+            }
+            m_memory = static_cast<uint8_t*>(allocator.allocate(numBuffers * m_stride, QUICKLOG_CACHE_LINE));
+            if(m_memory == nullptr){
+                QUICKLOG_ERROR("LocalLogger buffers couldn't be allocated.\n");
+                return;
+            }
+            m_size = numBuffers;
+            for(size_t i=0; i<numBuffers; i++){
+                Header *header = new(m_memory + i * m_stride) Header;
+                header->buffer.setData(m_memory + i * m_stride + headerSize, bufferSize);
+            }
+        }
+
+        ~LoggerBuffers(){
+            if(m_memory){
+                for(size_t i=0; i<m_size; i++){
+                    header(i).~Header();
+                }
+                m_free(m_allocator, m_memory, m_size * m_stride);
+            }
+        }
+
+        LoggerBuffers(const LoggerBuffers &) = delete;
+        LoggerBuffers & operator=(const LoggerBuffers &) = delete;
+
+        Buffer & operator[](size_t i){
+            return header(i).buffer;
+        }
+
+        unsigned long & reportedDrops(size_t i){
+            return header(i).reportedDrops;
+        }
+
+        size_t size() const{
+            return m_size;
+        }
+
+        size_t wrap(size_t i) const{
+            return i & m_mask;
+        }
+
+        size_t stride() const{
+            return m_stride;
+        }
+
+    private:
+        struct Header{
+            Buffer buffer;
+            unsigned long reportedDrops = 0;
+        };
+
+        static constexpr size_t headerSize = (sizeof(Header) + QUICKLOG_CACHE_LINE - 1) / QUICKLOG_CACHE_LINE * QUICKLOG_CACHE_LINE;
+
+        Header & header(size_t i){
+            return *reinterpret_cast<Header*>(m_memory + i * m_stride);
+        }
+
+        template<class Allocator>
+        static void deallocate(void *allocator, void *memory, size_t size){
+            static_cast<Allocator*>(allocator)->deallocate(memory, size);
+        }
+
+        uint8_t *m_memory = nullptr;
+        size_t m_size = 0;
+        const size_t m_mask;
+        const size_t m_stride;
+        void *m_allocator;
+        void (*m_free)(void *allocator, void *memory, size_t size);
+    };
+
+
+
+    /**
+     * @brief log() for LocalLogger, RingLocalLogger and quicklog_shm.h's ShmLogger.
+     * 
+     * Checks QUICKLOG_FMT formats and levels, and reports the entries OverflowPolicy drops
+     * via #QUICKLOG_DROPPED ahead of the next one that fits. Derived has a
+     * <tt>bool push(const Ts & ... vs)</tt>, an <tt>unsigned long dropped</tt>,
+     * <tt>void countDrop()</tt> for its stats and <tt>void droppedReported()</tt>, called
+     * once dropped has been logged.
+     */
+    template<class Derived, class OverflowPolicy>
+    class LoggerFrontEnd{
+    public:
+        /**
+         * @brief Submit a log message.
+         * 
+         * Will not block or make any calls to snprintf etc, unless OverflowPolicy says to wait
+         * for a full logger.
+         * 
+         * Arguments are taken by reference and each one is copied once, straight into the
+         * buffer, so large ones aren't copied on the way.
+         * 
+         * @tparam Ts arbitrary types.
+         * @param vs arbitrary values.
+         */
+        template <typename ...Ts>
+        void log(Ts && ... vs){
+            // arrays and functions are logged as pointers, as if passed by value.
+            logArgs<typename std::decay<Ts>::type ...>(vs ...);
+        }
+
+    protected:
+        template <typename ...Ts>
+        void logArgs(const Ts & ... vs){
+            static_assert(FormatCheck<Ts ...>::value, "QUICKLOG_FMT format string doesn't match the arguments to log().");
+            Derived & logger = derived();
+            if(EntryLevel<Ts ...>::value >= 0 && !logger.levelEnabled(static_cast<Level>(EntryLevel<Ts ...>::value))){
+                return;
+            }
+
+            if(OverflowPolicy::drops && logger.dropped && !reportDropped()){
+                ++logger.dropped;
+                logger.countDrop();
+                return;
+            }
+
+            if(!logger.push(vs ...) && OverflowPolicy::drops){
+                ++logger.dropped;
+                logger.countDrop();
+            }
+        }
+
+        /** @brief push() for arguments that haven't been through log(). */
+        template <typename ...Ts>
+        bool pushDecayed(Ts && ... vs){
+            return derived().template push<typename std::decay<Ts>::type ...>(vs ...);
+        }
+
+        bool reportDropped(){
+            Derived & logger = derived();
+            if(!pushDecayed(QUICKLOG_DROPPED(logger.dropped))){
+                return false;
+            }
+            logger.droppedReported();
+            logger.dropped = 0;
+            return true;
+        }
+
+    private:
+        Derived & derived(){
+            return static_cast<Derived&>(*this);
+        }
+    };
+
+}; // detail
+
+using namespace detail;
+
+
+/**
+ * @brief Overflow policy. Call #QUICKLOG_ERROR when a LocalLogger is full.
+ * 
+ * The default. If #QUICKLOG_ERROR returns the entry is dropped.
+ */
+struct ErrorOnFull{
+    static constexpr bool drops = false;
+
+    template<class Logger>
+    static bool onFull(Logger &){
+        QUICKLOG_ERROR("LocalLogger full. Can't log()\n");
+        return false;
+    }
+};
+
+/**
+ * @brief Overflow policy. Drop entries logged while a LocalLogger is full.
+ * 
+ * The number of dropped entries is logged via #QUICKLOG_DROPPED once there is room again.
+ */
+struct DropNewest{
+    static constexpr bool drops = true;
+
+    template<class Logger>
+    static bool onFull(Logger &){
+        return false;
+    }
+};
+
+/**
+ * @brief Overflow policy. When a LocalLogger is full, discard its oldest buffer
+ * that the server hasn't started printing, and reuse it. ie: flight-recorder mode.
+ * 
+ * Discarded entries are counted and reported like DropNewest.
+ */
+struct OverwriteOldest{
+    static constexpr bool drops = true;
+
+    template<class Logger>
+    static bool onFull(Logger & logger){
+        logger.overwriteOldest();
+        return true;
+    }
+};
+
+/**
+ * @brief Overflow policy. Busy wait until the server frees a buffer.
+ */
+struct Spin{
+    static constexpr bool drops = false;
+
+    template<class Logger>
+    static bool onFull(Logger & logger){
+        while(logger.full()){}
+        return true;
+    }
+};
+
+/**
+ * @brief Overflow policy. Busy wait up to maxSpins iterations for the server to
+ * free a buffer, then drop the entry like DropNewest.
+ */
+template<size_t maxSpins>
+struct BoundedSpin{
+    static constexpr bool drops = true;
+
+    template<class Logger>
+    static bool onFull(Logger & logger){
+        for(size_t i=0; i<maxSpins; i++){
+            if(!logger.full()){
+                return true;
+            }
+        }
+        return !logger.full();
+    }
+};
+
+/**
+ * @brief Overflow policy. Block until the server frees a buffer.
+ * 
+ * Blocks via PlatformImpl::waitSpace() and PlatformImpl::notifySpace() if the
+ * LogServer's PlatformImpl has them (typically a semaphore get and put),
+ * otherwise busy waits.
+ */
+struct Block{
+    static constexpr bool drops = false;
+
+    template<class Logger>
+    static bool onFull(Logger & logger){
+        LogServerBase * server = logger.server;
+        if(server == nullptr){
+            QUICKLOG_ERROR("LocalLogger not registered to LogServer\n");
+            return false;
+        }
+        ++server->_spaceWaiters;
+        // pairs with the fence in LogServer::_dumpAll(), so either we see the free
+        // buffer or the server sees us waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(logger.full()){
+            server->_waitForSpace();
+        }
+        --server->_spaceWaiters;
+        return true;
+    }
+};
+
+
+/**
+ * @brief Allocator handing out pieces of one block of memory, e.g. for LocalLogger<dynamic, dynamic>
+ * buffers. Lock-free, and nothing is given back until the whole block is.
+ * \code{.cpp}
+ * static quicklog::Arena arena(memory, size);
+ * thread_local quicklog::LocalLogger<quicklog::dynamic, quicklog::dynamic> t_logger(64, 256 * 1024, arena);
+ * \endcode
+ */
+class Arena{
+public:
+    Arena(void *memory, size_t size): m_memory(static_cast<uint8_t*>(memory)), m_size(size){}
+
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+
+    /**
+     * @param align A power of two.
+     * @return size bytes aligned to align, or nullptr if there isn't room.
+     */
+    void * allocate(size_t size, size_t align){
+        size_t used = m_used.load(std::memory_order_relaxed);
+        size_t start;
+        do{
+            const uintptr_t address = reinterpret_cast<uintptr_t>(m_memory) + used;
+            start = used + ((align - address % align) % align);
+            if(start > m_size || size > m_size - start){
+                return nullptr;
+            }
+        }while(!m_used.compare_exchange_weak(used, start + size, std::memory_order_relaxed));
+        return m_memory + start;
+    }
+
+    /** @brief Does nothing. */
+    void deallocate(void *, size_t){}
+
+    /** @brief How many bytes have been handed out, including alignment. */
+    size_t used() const{
+        return m_used.load(std::memory_order_relaxed);
+    }
+
+private:
+    uint8_t * const m_memory;
+    const size_t m_size;
+    std::atomic<size_t> m_used{0};
+};
+
+
+/**
+ * @brief Where a logger was when it was flush()'d, to wait for with LogServer::waitDurable()
+ * or LogServer::onDurable().
+ */
+struct FlushSequence{
+    LocalLoggerBase *logger;
+    LogServerBase *worker;
+    // in units of the logger's own read cursor, buffers or bytes.
+    uint64_t position;
+};
+
+
+/**
+ * @brief Thread-local logger component.
+ * 
+ * Stores log entries without processing them in anyway. Calls to \ref log() will effectively
+ * result the arguments being memcpy'd into a buffer (ie: buffer). When the buffer fills up 
+ * LogServer will "dump" the results and call #QUICKLOG_PRINT on the original arguments to \ref log().
+ * By default #QUICKLOG_PRINT is printf, but it can be #define'd  as any function you want, with any type-signature,
+ * as long as it matches the corresponding call to \ref log().
+ * 
+ * @tparam numBuffers The number of buffers, or #dynamic.
+ * @tparam bufferSize The size of the buffers in bytes, or #dynamic.
+ * @tparam AlignPolicy How records are aligned in the buffers. One of MaxAlign, FixedAlign or NaturalAlign.
+ * @tparam OverflowPolicy What \ref log() does when all buffers are full. One of ErrorOnFull,
+ * DropNewest, OverwriteOldest, Spin, BoundedSpin or Block.
+ */
+template<size_t numBuffers, size_t bufferSize, class AlignPolicy = MaxAlign, class OverflowPolicy = ErrorOnFull>
+class LocalLogger: public LocalLoggerBase,
+                   public LoggerFrontEnd<LocalLogger<numBuffers, bufferSize, AlignPolicy, OverflowPolicy>, OverflowPolicy>
+{
+    static_assert((numBuffers == dynamic) == (bufferSize == dynamic), "numBuffers and bufferSize must both be dynamic or neither.");
+
+public:
+    LocalLogger(){
+        m_capacity = numBuffers;
+    }
+
+    /**
+     * @brief For LocalLogger<dynamic, dynamic>. Allocate the buffers in one piece from
+     * allocator, e.g. an Arena or quicklog_posix.h's HugePageAllocator, instead of storing
+     * them in the logger. They're given back to it when the logger is destroyed.
+     * 
+     * @param count The number of buffers, a power of two.
+     * @param size The size of each buffer in bytes.
+     * @param allocator Has void *allocate(size_t size, size_t align) and
+     * void deallocate(void *memory, size_t size). Must outlive the logger.
+     */
+    template<class Allocator>
+    LocalLogger(size_t count, size_t size, Allocator & allocator):
+        buffers(count, size, allocator)
+    {
+        m_capacity = buffers.size();
+    }
+
+    /**
+     * @brief Flush the current buffer.
+     * 
+     *  Flushes the current buffer and makes it available to be "dumped" by the LogServer.
+     *  If this function is never called, and there are no more calls to \ref log(), more recent 
+     *  log entries will never be printed. Also reports any entries dropped by OverflowPolicy.
+     * 
+     * @return Every buffer handed over so far, for LogServer::waitDurable() or LogServer::onDurable().
+     * If every buffer was full the current one couldn't be handed over, and isn't included.
+     */
+    FlushSequence flush(){
+        if(OverflowPolicy::drops && dropped){
+            this->reportDropped();
+        }
+        if(!full() && !buffers[writeIndex].isEmpty()){
+            nextIndex();
+        }
+        return FlushSequence{this, server, handedOver};
+    }
+
+private:
+    template <typename ...Ts>
+    bool push(const Ts & ... vs){
+        if(full() && !onFull()){
+            return false;
+        }
+        if(const size_t size = buffers[writeIndex].pushEntry(vs ...)){
+            pushed(size);
+            return true;
+        }
+
+        nextIndex();
+        if(full() && !onFull()){
+            return false;
+        }
+        const size_t size = buffers[writeIndex].pushEntry(vs ...);
+        if(!size){
+            QUICKLOG_ERROR("Log entries bigger than buffer size\n");
+            return false;
+        }
+        pushed(size);
+        return true;
+    }
+
+    bool onFull(){
+        statAdd(m_counters.full);
+        return OverflowPolicy::onFull(*this);
+    }
+
+    void pushed(size_t size){
+        statAdd(m_counters.entries);
+        statAdd(m_counters.bytes, size);
+    }
+
+    void countDrop(){
+        statAdd(m_counters.dropped);
+    }
+
+    void droppedReported(){
+        buffers.reportedDrops(writeIndex) += dropped - 1;
+    }
+
+    virtual bool dump(OutputBuffer *out, const TimestampClock & clock){
+        if(!claimNext()){
+            if(stalePos == staleEnd){
+                return false;
+            }
+            // the producer's current buffer, taken by takeStale().
+            const size_t n = buffers[readIndex].dumpRange(out, clock, stalePos, staleEnd);
+            staleCount += n;
+            stalePos = staleEnd;
+            statAdd(m_printed, n);
+            return true;
+        }
+        const size_t n = buffers[readIndex].count() - staleCount;
+        buffers[readIndex].dumpRecords(out, clock, stalePos, n);
+        statAdd(m_printed, n);
+        buffers[readIndex].clear();
+        clearStale();
+        release();
+        return true;
+    }
+
+    virtual const uint8_t * peek(){
+        while(recordsLeft == 0){
+            if(!claimNext()){
+                return stalePos == staleEnd ? nullptr : buffers[readIndex].record(stalePos);
+            }
+            recordPos = stalePos;
+            recordsLeft = buffers[readIndex].count() - staleCount;
+            clearStale();
+            if(recordsLeft == 0){
+                buffers[readIndex].clear();
+                release();
+            }
+        }
+        return buffers[readIndex].record(recordPos);
+    }
+
+    virtual bool pop(OutputBuffer *out, const TimestampClock & clock){
+        const bool stale = recordsLeft == 0;
+        const uint8_t *record = buffers[readIndex].record(stale ? stalePos : recordPos);
+        RecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        decoderTable()[header.decoder](record, out, clock);
+        statAdd(m_printed);
+        if(stale){
+            stalePos += header.size;
+            ++staleCount;
+            return false;
+        }
+        recordPos += header.size;
+        if(--recordsLeft){
+            return false;
+        }
+        buffers[readIndex].clear();
+        release();
+        return true;
+    }
+
+    /**
+     * @brief Once everything handed over has been printed, readIndex is the producer's
+     * current buffer. Entries published to it can be read while the producer carries on
+     * writing after them, and even hands it over, since only the server frees it.
+     */
+    virtual void takeStale(uint64_t nowNs, uint64_t maxAgeNs){
+        // OverwriteOldest's producer clears buffers itself.
+        if(std::is_same<OverflowPolicy, OverwriteOldest>::value || recordsLeft
+            || buffersFull.unclaimed(buffersFull.claims()))
+        {
+            return;
+        }
+        const size_t end = buffers[readIndex].published();
+        if(end == staleEnd){
+            staleSince = 0;
+        }else if(staleSince == 0){
+            staleSince = nowNs;
+        }else if(nowNs - staleSince >= maxAgeNs){
+            staleEnd = end;
+            staleSince = 0;
+        }
+    }
+
+    void clearStale(){
+        stalePos = staleEnd = staleCount = 0;
+        staleSince = 0;
+    }
+
+    /**
+     * @brief Claim the next full buffer for the server, making it readIndex.
+     */
+    bool claimNext(){
+        uint32_t claims = buffersFull.claims();
+        do{
+            if(buffersFull.unclaimed(claims) == 0){
+                return false;
+            }
+        }while(!buffersFull.claim(claims));
+
+        // skip any buffers overwriteOldest() claimed since our last claim.
+        readIndex = buffers.wrap(readIndex + buffers.wrap(claims - expectedClaims));
+        expectedClaims = claims + 1;
+        return true;
+    }
+
+    /**
+     * @brief Hand the claimed buffer, now empty, back to the producer.
+     */
+    void release(){
+        readIndex = buffers.wrap(readIndex + 1);
+        buffersFull.get(); //guaranteed to succeed
+    }
+
+
+    /**
+     * @brief Take back the oldest full buffer, which is the one at writeIndex, unless
+     * the server has already claimed it, in which case wait for the server to finish with it.
+     */
+    void overwriteOldest(){
+        uint32_t claims = buffersFull.claims();
+        if(claims == buffersFull.gets() && buffersFull.claim(claims)){
+            dropped += buffers[writeIndex].count() + buffers.reportedDrops(writeIndex);
+            statAdd(m_counters.dropped, buffers[writeIndex].count());
+            buffers.reportedDrops(writeIndex) = 0;
+            buffers[writeIndex].clear();
+            buffersFull.get();
+            return;
+        }
+        while(full()){}
+        buffers.reportedDrops(writeIndex) = 0;
+    }
+
+
+    virtual uint64_t _readCursor(){
+        cursor += uint32_t(buffersFull.gets() - uint32_t(cursor));
+        return cursor;
+    }
+
+    virtual void crashDump(OutputBuffer *out, const TimestampClock & clock){
+        // oldest first. When full, the writeIndex buffer is the oldest, the server's.
+        const size_t first = full() ? writeIndex : writeIndex + 1;
+        for(size_t i=0; i<buffers.size(); i++){
+            const size_t index = buffers.wrap(first + i);
+            if(index == readIndex && recordsLeft){
+                // partly popped by mergeByTimestamp().
+                buffers[index].dumpRecords(out, clock, recordPos, recordsLeft);
+            }else if(index == readIndex && stalePos){
+                // partly printed by autoFlush().
+                buffers[index].dumpRecords(out, clock, stalePos, buffers[index].count() - staleCount);
+            }else{
+                buffers[index].dumpRecords(out, clock, 0, buffers[index].count());
+            }
+        }
+    }
+
+    void describe(CrashDescriptor & crash){
+        crash.fields[crash::kind] = crash::buffers;
+        crash.fields[crash::first] = buffers.size();
+        crash.fields[crash::first + 1] = buffers.stride();
+        buffers[0].describe(crash, crash::first + 2);
+        crash.set(crash::first + 5, &writeIndex);
+        crash.set(crash::first + 6, &readIndex);
+        crash.set(crash::first + 7, &recordPos);
+        crash.set(crash::first + 8, &recordsLeft);
+        buffersFull.describe(crash, crash::first + 9);
+    }
+
+    bool full(){
+        return buffersFull.peek(buffers.size()) == buffers.size();
+    }
+
+    /** @brief Whether there's anything flush() hasn't handed over to the server yet. */
+    bool pending(){
+        // when full, writeIndex is the server's oldest buffer and there's nothing to hand over.
+        return (OverflowPolicy::drops && dropped) || (!full() && !buffers[writeIndex].isEmpty());
+    }
+
+
+    void nextIndex(){
+        if(!full()){
+            writeIndex = buffers.wrap(writeIndex + 1);
+            buffersFull.put();
+            ++handedOver;
+            statAdd(m_counters.handovers);
+            statMax(m_counters.peakUsed, buffersFull.peek(buffers.size()));
+            if(!full()){
+                buffers.reportedDrops(writeIndex) = 0;
+            }
             if(server == nullptr){
                 QUICKLOG_ERROR("LocalLogger not registered to LogServer\n");
             }else{
                 server->_onDumpAvail();
             }
-        }else{
-            QUICKLOG_ERROR("localLogger full, can't nextIndex()");
+        }else{
+            QUICKLOG_ERROR("localLogger full, can't nextIndex()");
+        }
+    }
+
+    // with the dropped entries reported in each buffer, less the reports themselves. For overwriteOldest().
+    LoggerBuffers<numBuffers, bufferSize, AlignPolicy> buffers;
+    semaphore buffersFull;
+
+    // producer side
+    alignas(QUICKLOG_CACHE_LINE) uint32_t writeIndex = 0;
+    unsigned long dropped = 0;
+    LogServerBase * server = nullptr;
+    // buffers put, without buffersFull's wrap around.
+    uint64_t handedOver = 0;
+
+    // server side
+    alignas(QUICKLOG_CACHE_LINE) uint32_t readIndex = 0;
+    uint32_t expectedClaims = 0;
+    // buffers got, printed or taken back by overwriteOldest(), without the wrap around.
+    uint64_t cursor = 0;
+    // position in the claimed buffer, for peek() and pop().
+    size_t recordPos = 0;
+    size_t recordsLeft = 0;
+    // how much of the producer's current buffer takeStale() let the server have, and how
+    // many records of it have been printed, up to stalePos.
+    size_t stalePos = 0;
+    size_t staleEnd = 0;
+    size_t staleCount = 0;
+    // when the server first saw entries it couldn't have yet, or 0.
+    uint64_t staleSince = 0;
+
+    template<size_t maxLoggers, class PlatformImpl, class Sink, size_t stagingSize, size_t numWorkers>
+    friend class LogServer;
+    friend OverflowPolicy;
+    friend class LoggerFrontEnd<LocalLogger, OverflowPolicy>;
+};
+
+
+/**
+ * @brief Thread-local logger component that commits every entry as soon as it's logged.
+ * 
+ * An alternative to LocalLogger. Instead of handing whole buffers to the LogServer,
+ * \ref log() writes each entry into a single ring of ringSize bytes and publishes it
+ * straight away, so the server can print it on its next pass, however little
+ * traffic there is. The LogServer is only notified each time half the ring has been
+ * written, and on \ref flush(), so a LogServer whose PlatformImpl::wait() blocks
+ * until notified should also wake up periodically.
+ * 
+ * Entries that don't fit before the end of the ring are preceded by a padding record
+ * and written at the start.
+ * 
+ * @tparam ringSize The size of the ring in bytes. A power of two.
+ * @tparam AlignPolicy How records are aligned in the ring. One of MaxAlign, FixedAlign or NaturalAlign.
+ * @tparam OverflowPolicy What \ref log() does when the ring is full. Any policy but OverwriteOldest.
+ */
+template<size_t ringSize, class AlignPolicy = MaxAlign, class OverflowPolicy = ErrorOnFull>
+class RingLocalLogger: public LocalLoggerBase,
+                       public LoggerFrontEnd<RingLocalLogger<ringSize, AlignPolicy, OverflowPolicy>, OverflowPolicy>
+{
+    static_assert(ringSize >= QUICKLOG_ALIGN && !(ringSize & (ringSize - 1)), "ringSize must be a power of two.");
+    static_assert(!std::is_same<OverflowPolicy, OverwriteOldest>::value, "RingLocalLogger doesn't support OverwriteOldest.");
+
+public:
+    RingLocalLogger(){
+        m_capacity = ringSize;
+    }
+
+    /**
+     * @brief Wake the LogServer to print everything logged so far.
+     * 
+     * Entries are available to the server as soon as they're logged, so this is only
+     * needed when the server waits to be notified. Also reports any entries dropped
+     * by OverflowPolicy.
+     * 
+     * @return Everything logged so far, for LogServer::waitDurable() or LogServer::onDurable().
+     */
+    FlushSequence flush(){
+        if(OverflowPolicy::drops && dropped){
+            this->reportDropped();
+        }
+        notify();
+        return FlushSequence{this, server, committed.load(std::memory_order_relaxed)};
+    }
+
+private:
+    template <typename ...Ts>
+    bool push(const Ts & ... vs){
+        if(tryPush(vs ...)){
+            return true;
+        }
+        statAdd(m_counters.full);
+        do{
+            notify();
+            if(!OverflowPolicy::onFull(*this)){
+                return false;
+            }
+        }while(!tryPush(vs ...));
+        return true;
+    }
+
+    template <typename ...Ts>
+    bool tryPush(const Ts & ... vs){
+        typedef LogEntry<AlignPolicy, Ts ...> Entry;
+        static_assert(2 * Entry::maxSize <= ringSize, "Log entry too big for RingLocalLogger.");
+
+        const size_t pos = writePos & (ringSize - 1);
+        const size_t copied = Entry::copySize(vs ...);
+        size_t padding = 0;
+        size_t entryPos = pos;
+        size_t entrySize = Entry::size(pos, copied);
+        if(pos + entrySize > ringSize){
+            padding = ringSize - pos;
+            entryPos = 0;
+            entrySize = Entry::size(0, copied);
+        }
+
+        needed = padding + entrySize;
+        if(full()){
+            return false;
+        }
+
+        if(padding >= sizeof(RecordHeader)){
+            PaddingEntry::write(&ring[pos], padding);
+        }
+        Entry::write(&ring[entryPos], entryPos, entrySize, vs ...);
+
+        const size_t oldPos = writePos;
+        writePos += needed;
+        committed.store(writePos, std::memory_order_release);
+        statAdd(m_counters.entries);
+        statAdd(m_counters.bytes, needed);
+        statMax(m_counters.peakUsed, writePos - cachedReadPos);
+
+        if((oldPos ^ writePos) & ~(ringSize / 2 - 1)){
+            notify();
+        }
+        return true;
+    }
+
+    void countDrop(){
+        statAdd(m_counters.dropped);
+    }
+
+    void droppedReported(){}
+
+    /** @brief Whether there's anything flush() hasn't handed over to the server yet. */
+    bool pending(){
+        return OverflowPolicy::drops && dropped;
+    }
+
+    void notify(){
+        if(server == nullptr){
+            QUICKLOG_ERROR("RingLocalLogger not registered to LogServer\n");
+        }else{
+            statAdd(m_counters.handovers);
+            server->_onDumpAvail();
+        }
+    }
+
+    virtual bool dump(OutputBuffer *out, const TimestampClock & clock){
+        size_t pos = readPos.load(std::memory_order_relaxed);
+        const size_t end = committed.load(std::memory_order_acquire);
+        if(pos == end){
+            return false;
+        }
+
+        const DecoderTable & decoders = decoderTable();
+        size_t n = 0;
+        while(pos != end){
+            const size_t offset = pos & (ringSize - 1);
+            if(ringSize - offset < sizeof(RecordHeader)){
+                // too small for a padding record.
+                pos += ringSize - offset;
+            }else{
+                RecordHeader header;
+                memcpy(&header, &ring[offset], sizeof(header));
+                decoders[header.decoder](&ring[offset], out, clock);
+                n += header.decoder != PaddingEntry::decoder();
+                pos += header.size;
+            }
+            readPos.store(pos, std::memory_order_release);
+        }
+        statAdd(m_printed, n);
+        return true;
+    }
+
+    virtual const uint8_t * peek(){
+        size_t pos = readPos.load(std::memory_order_relaxed);
+        while(true){
+            if(pos == cachedCommitted){
+                cachedCommitted = committed.load(std::memory_order_acquire);
+                if(pos == cachedCommitted){
+                    return nullptr;
+                }
+            }
+            const size_t offset = pos & (ringSize - 1);
+            if(ringSize - offset < sizeof(RecordHeader)){
+                pos += ringSize - offset;
+            }else{
+                RecordHeader header;
+                memcpy(&header, &ring[offset], sizeof(header));
+                if(header.decoder != PaddingEntry::decoder()){
+                    return &ring[offset];
+                }
+                pos += header.size;
+            }
+            readPos.store(pos, std::memory_order_release);
+        }
+    }
+
+    virtual bool pop(OutputBuffer *out, const TimestampClock & clock){
+        const size_t pos = readPos.load(std::memory_order_relaxed);
+        const uint8_t *record = &ring[pos & (ringSize - 1)];
+        RecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        decoderTable()[header.decoder](record, out, clock);
+        readPos.store(pos + header.size, std::memory_order_release);
+        statAdd(m_printed);
+        return true;
+    }
+
+    virtual uint64_t _readCursor(){
+        return readPos.load(std::memory_order_relaxed);
+    }
+
+    virtual void crashDump(OutputBuffer *out, const TimestampClock & clock){
+        const DecoderTable & decoders = decoderTable();
+        const size_t end = committed.load(std::memory_order_acquire);
+        size_t pos = readPos.load(std::memory_order_acquire);
+        while(pos != end && end - pos <= ringSize){
+            const size_t offset = pos & (ringSize - 1);
+            if(ringSize - offset < sizeof(RecordHeader)){
+                pos += ringSize - offset;
+                continue;
+            }
+            RecordHeader header;
+            memcpy(&header, &ring[offset], sizeof(header));
+            if(header.size == 0){
+                // torn by the crash.
+                return;
+            }
+            decoders[header.decoder](&ring[offset], out, clock);
+            pos += header.size;
+        }
+    }
+
+    void describe(CrashDescriptor & crash){
+        crash.fields[crash::kind] = crash::ring;
+        crash.fields[crash::first] = ringSize;
+        crash.set(crash::first + 1, ring);
+        crash.set(crash::first + 2, &readPos);
+        crash.set(crash::first + 3, &committed);
+    }
+
+    /**
+     * @brief True if the entry tryPush() last attempted doesn't fit.
+     * 
+     * Only rereads the server's read position when the last one seen says it doesn't fit.
+     */
+    bool full(){
+        if(ringSize - (writePos - cachedReadPos) >= needed){
+            return false;
+        }
+        cachedReadPos = readPos.load(std::memory_order_acquire);
+        return ringSize - (writePos - cachedReadPos) < needed;
+    }
+
+    uint8_t ring[ringSize] alignas(QUICKLOG_ALIGN);
+
+    // producer side
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<size_t> committed{0};
+    size_t writePos = 0;
+    size_t cachedReadPos = 0;
+    size_t needed = 0;
+    unsigned long dropped = 0;
+    LogServerBase * server = nullptr;
+
+    // server side
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<size_t> readPos{0};
+    size_t cachedCommitted = 0;
+
+    template<size_t maxLoggers, class PlatformImpl, class Sink, size_t stagingSize, size_t numWorkers>
+    friend class LogServer;
+    friend OverflowPolicy;
+    friend class LoggerFrontEnd<RingLocalLogger, OverflowPolicy>;
+};
+
+
+/**
+ * @brief LogServer sink. Calls #QUICKLOG_PRINT once per entry.
+ * 
+ * The default.
+ */
+struct PrintSink{
+    static constexpr bool buffered = false;
+
+    void write(const char *, size_t){}
+};
+
+
+/**
+ * @brief LogServer sink. Entries are formatted with #QUICKLOG_FORMAT into the server's
+ * staging buffer, which is written to a FILE* with a single fwrite() and fflush() each
+ * time it fills up and at the end of every pass over the loggers.
+ * 
+ * Writes to stdout unless setFile() is called before the server starts.
+ */
+class StdioSink{
+public:
+    static constexpr bool buffered = true;
+
+    void setFile(FILE *file){
+        m_file = file;
+    }
+
+    void write(const char *data, size_t size){
+        fwrite(data, 1, size, m_file);
+        fflush(m_file);
+    }
+
+private:
+    FILE * m_file = stdout;
+};
+
+
+/**
+ * @brief LogServer sink adaptor. Instead of formatting entries, the server writes them to
+ * Sink in the binary format described in detail::binary, to be rendered later by quicklog_decode.
+ * 
+ * Entries logged via #QUICKLOG or #QUICKLOG_SITE are written as their site ID and raw
+ * arguments, with the site's format, file, line, level and argument types written once
+ * before its first entry. Other entries are formatted with #QUICKLOG_FORMAT and written as text.
+ * 
+ * \code{.cpp}
+ * quicklog::LogServer<MAX_LOCAL_LOGGERS, ExamplePlatformImpl, quicklog::BinarySink<quicklog::FdSink>> g_server;
+ * \endcode
+ * 
+ * @tparam Sink A buffered sink, e.g. StdioSink or FdSink.
+ */
+template<class Sink>
+class BinarySink : public Sink{
+public:
+    static_assert(Sink::buffered, "BinarySink requires a buffered sink.");
+    static constexpr bool binary = true;
+};
+
+
+/**
+ * @brief LogServer PlatformImpl that waits for entries without putting a syscall on
+ * the loggers' side in the common case.
+ * 
+ * An idle server polls the loggers spins times, then polls between yields times
+ * Parker::yield(), then parks in Parker::park() until a logger notifies it or
+ * parkTimeoutNs passes. notify() is a fence and a load of a flag that's only set while
+ * the server is parked, so loggers only make a syscall to wake a parked server, and the
+ * first one to see it parked is the only one that does. The server polls once more after
+ * setting the flag, so an entry logged just before then isn't missed.
+ * 
+ * Also implements waitSpace() and notifySpace() for the Block overflow policy. Those
+ * waits are bounded by spaceTimeoutNs, since a logger can start waiting just after the
+ * server's notifySpace().
+ * 
+ * The timeout keeps RingLocalLogger entries and mergeByTimestamp() moving when the
+ * loggers don't notify. quicklog_posix.h has Parkers, e.g. \code{.cpp}
+ * quicklog::LogServer<MAX_LOCAL_LOGGERS, quicklog::SpinYieldPark<quicklog::FutexParker>> g_server;
+ * \endcode
+ * 
+ * @tparam Parker A class with <tt>void park(std::atomic<uint32_t> & word, uint32_t expected, uint64_t timeoutNs)</tt>,
+ * which sleeps while word is expected for up to timeoutNs, <tt>void wake(std::atomic<uint32_t> & word)</tt>,
+ * which wakes every thread parked on word, and <tt>void yield()</tt>.
+ * @tparam spins Number of polls before yielding.
+ * @tparam yields Number of yields before parking.
+ * @tparam parkTimeoutNs Longest time the server's parked, in nanoseconds.
+ * @tparam spaceTimeoutNs Longest time in one waitSpace(), in nanoseconds.
+ */
+template<class Parker, size_t spins = 1000, size_t yields = 100, uint64_t parkTimeoutNs = 100000000,
+    uint64_t spaceTimeoutNs = 1000000>
+class SpinYieldPark{
+public:
+    /** @brief Server waits for poll() to find entries. */
+    template<class Poll>
+    void wait(Poll poll){
+        for(size_t i=0; i<spins; i++){
+            if(poll()){
+                return;
+            }
+            detail::cpuRelax();
+        }
+        for(size_t i=0; i<yields; i++){
+            if(poll()){
+                return;
+            }
+            parker.yield();
+        }
+        parked.store(1, std::memory_order_relaxed);
+        // pairs with the fence in notify(), so either we see the entry or the logger sees us parked.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!poll()){
+            parker.park(parked, 1, parkTimeoutNs);
         }
+        parked.store(0, std::memory_order_relaxed);
     }
 
-    EntryBuffer<bufferSize> buffers[numBuffers];
-    volatile uint8_t writeIndex = 0;
-    volatile uint8_t readIndex = 0;
-    semaphore buffersFull;
-    LogServerBase * server = nullptr;
+    /** @brief Server is notified of logs being available to print. */
+    void notify(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(parked.load(std::memory_order_relaxed) && parked.exchange(0, std::memory_order_relaxed)){
+            parker.wake(parked);
+        }
+    }
 
-    template<size_t maxLoggers, class PlatformImpl>
-    friend class LogServer;
+    /** @brief Logger with a Block overflow policy waits for the server to free a buffer. */
+    void waitSpace(){
+        parker.park(spaceEpoch, spaceEpoch.load(std::memory_order_relaxed), spaceTimeoutNs);
+    }
+
+    /** @brief Server has freed a buffer and there are loggers in waitSpace(). */
+    void notifySpace(){
+        spaceEpoch.fetch_add(1, std::memory_order_relaxed);
+        parker.wake(spaceEpoch);
+    }
+
+private:
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> parked{0};
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> spaceEpoch{0};
+    Parker parker;
 };
 
 
 /**
  * @brief Server responsible for managing LocalLogger instances and performing actual printing.
  * 
+ * Loggers can be drained by several threads, each running one of numWorkers workers with
+ * its own PlatformImpl, Sink and staging buffer. The loggers are sharded between them in
+ * the order they're registered, slot n going to worker n % numWorkers, or as chosen by
+ * assignWorkers().
+ * 
  * @tparam maxLoggers Maximum number of LocalLogger instaces that can be registered.
  * @tparam PlatformImpl A user supplied platform specific features. See ExamplePlatformImpl.
+ * @tparam Sink Where entries go. PrintSink, StdioSink, or any class with a
+ * <tt>static constexpr bool buffered</tt> and a <tt>void write(const char *data, size_t size)</tt>.
+ * The write() of a buffered sink receives batches of formatted entries. Wrap a buffered
+ * sink in BinarySink to write entries in the binary format instead.
+ * A buffered sink can also have an <tt>OutputWindow window(bool boundary)</tt>, giving the
+ * memory entries are formatted into next so write() only has to commit them, see MmapSink.
+ * @tparam stagingSize Size in bytes of the staging buffer used with buffered sinks.
+ * @tparam numWorkers Number of drain threads. See processWorker().
  */
-template<size_t maxLoggers, class PlatformImpl>
-class LogServer : public LogServerBase {
+template<size_t maxLoggers, class PlatformImpl, class Sink = PrintSink, size_t stagingSize = 64*1024,
+    size_t numWorkers = 1>
+class LogServer{
+    static_assert(numWorkers > 0, "LogServer needs at least one worker.");
 
+    class Worker;
 
 public:
+    LogServer(){
+        for(size_t i=0; i<numWorkers; i++){
+            workers[i].m_server = this;
+            workers[i].m_index = i;
+        }
+    }
+
+    /**
+     * @brief The Sink instance of a worker, e.g. to configure it before starting the server.
+     * 
+     * Workers write to their own sinks concurrently, so either give each one a separate
+     * destination or use a sink whose write() is atomic, e.g. FdSink on a pipe or an
+     * O_APPEND file.
+     */
+    Sink & sink(size_t worker = 0){
+        return workers[worker].outputSink;
+    }
+
+    /**
+     * @brief Choose which worker drains each logger from then on, instead of sharding them
+     * evenly. Call before any addLogger().
+     * 
+     * choose() is called by addLogger() on the logger's thread, and its result modulo
+     * numWorkers is the worker, e.g. quicklog::currentNumaNode() from quicklog_posix.h for
+     * a worker per NUMA node that only reads buffers written on its own node. A slot keeps
+     * the worker it was first handed out for, so one removed by removeLogger() is only
+     * reused by a logger for the same worker. Any worker can have up to maxLoggers loggers.
+     */
+    void assignWorkers(size_t (*choose)()){
+        chooseWorker = choose;
+    }
+
+    /**
+     * @brief Register a LocalLogger or RingLocalLogger. To be called from LocalLogger thread only.
+     * 
+     * Lock-free. Slots given up by removeLogger() are reused, otherwise new ones are handed
+     * out with an atomic increment. Each one is published with a release store, so
+     * registering never waits on the server thread.
+     * 
+     * @tparam Logger 
+     * @param logger 
+     */
+    template<class Logger>
+    void addLogger(Logger & logger){
+        const size_t wanted = chooseWorker ? chooseWorker() % numWorkers : numWorkers;
+        size_t slot = freeSlot(wanted);
+        if(slot == maxLoggers){
+            slot = nLoggers.fetch_add(1, std::memory_order_relaxed);
+            if(slot >= maxLoggers){
+                QUICKLOG_ERROR("Attempt to add more than maxLoggers loggers to LogServer, counting "
+                        "slots left free by removeLogger() for other workers.\n");
+                return;
+            }
+            // never changes, so workers can read it once they see a logger in the slot.
+            slotWorkers[slot].store(wanted == numWorkers ? slot % numWorkers : wanted, std::memory_order_relaxed);
+        }
+        Worker & worker = workers[slotWorkers[slot].load(std::memory_order_relaxed)];
+        logger.server = &worker;
+        logger._slot = slot;
+        logger.describe(logger._crash);
+        worker.clock.describe(logger._crash);
+        memcpy(logger._crash.magic, crash::loggerMagic, sizeof(crash::loggerMagic));
+        logger._removing.store(false, std::memory_order_relaxed);
+        logger._removed.store(false, std::memory_order_relaxed);
+        logger._waitersClosed.store(false, std::memory_order_relaxed);
+        localLoggers[slot].store(static_cast<LocalLoggerBase*>( & logger), std::memory_order_release);
+    }
 
     /**
-     * @brief Register a LocalLogger. To be called from LocalLogger thread only.
+     * @brief Unregister a logger once the server has printed all of its entries, e.g. before
+     * its thread exits. To be called from the logger's thread only. See ScopedLocalLogger.
      * 
-     * @tparam n 
-     * @tparam sz 
+     * Flushes the logger and waits for the server's next pass to print what's left and give
+     * up the logger's slot for reuse by addLogger(). Waits like the Block overflow policy, via
+     * PlatformImpl::waitSpace() if there is one. If the server has already shut down,
+     * anything left is discarded. The logger can be destroyed or added again afterwards.
+     * 
+     * @tparam Logger 
      * @param logger 
      */
-    template<size_t n, size_t sz>
-    void addLogger(LocalLogger<n, sz> & logger){
-        platform.lock();
-        if(nLoggers == maxLoggers){
-            QUICKLOG_ERROR("Attempt to add more than maxLoggers loggers to LogServer.\n");
-        }else{
-            localLoggers[nLoggers] =  static_cast<LocalLoggerBase*>( & logger);
-            ++nLoggers;
+    template<class Logger>
+    void removeLogger(Logger & logger){
+        LogServerBase * worker = logger.server;
+        if(worker == nullptr){
+            QUICKLOG_ERROR("Attempt to remove a logger that isn't registered to LogServer.\n");
+            return;
+        }
+        ++worker->_spaceWaiters;
+        // pairs with the fence in the server's _notifySpace(), as in Block::onFull().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        logger.flush();
+        while(logger.pending() && !worker->_stopped.load(std::memory_order_acquire)){
+            worker->_waitForSpace();
+            logger.flush();
+        }
+        logger._removing.store(true, std::memory_order_release);
+        worker->_onDumpAvail();
+        while(!logger._removed.load(std::memory_order_acquire)){
+            if(worker->_stopped.load(std::memory_order_acquire)){
+                releaseSlot(logger._slot);
+                break;
+            }
+            worker->_waitForSpace();
+        }
+        --worker->_spaceWaiters;
+        // the slot is free, so a loggerStats() that counts itself under the slot's next
+        // generation won't see the logger. Wait for any counted under this one.
+        const uint32_t gen = slotGens[logger._slot].fetch_add(1, std::memory_order_acq_rel);
+        while(slotReaders[logger._slot][gen & 1].fetch_add(0, std::memory_order_acq_rel)){
+            detail::cpuRelax();
+        }
+        logger.server = nullptr;
+        memset(logger._crash.magic, 0, sizeof(logger._crash.magic));
+    }
+
+    /**
+     * @brief Whether the entries before seq, from a logger's flush(), have all been printed and
+     * passed to the sink. Doesn't block. Can be called from any thread.
+     * 
+     * For buffered sinks that means they've been written with Sink::write(), not that the
+     * sink has synced them to disk.
+     */
+    bool isDurable(const FlushSequence & seq) const{
+        return seq.logger->_durable(seq.position);
+    }
+
+    /**
+     * @brief Wait until isDurable(seq), like removeLogger() waits, via PlatformImpl::waitSpace()
+     * if there is one. Can be called from any thread.
+     * 
+     * @return false if the server shut down first without printing them.
+     */
+    bool waitDurable(const FlushSequence & seq){
+        if(isDurable(seq)){
+            return true;
+        }
+        if(seq.worker == nullptr){
+            QUICKLOG_ERROR("waitDurable() on a logger that isn't registered to LogServer.\n");
+            return false;
+        }
+        LogServerBase * worker = seq.worker;
+        ++worker->_spaceWaiters;
+        // pairs with the fence in the server's _notifySpace(), as in Block::onFull().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(!isDurable(seq) && !worker->_stopped.load(std::memory_order_acquire)){
+            worker->_waitForSpace();
+        }
+        --worker->_spaceWaiters;
+        return isDurable(seq);
+    }
+
+    /**
+     * @brief Call callback.fn(callback.arg, true) once isDurable(seq), without blocking, e.g. to
+     * resume a coroutine (see durable()) or complete a future. From any thread.
+     * 
+     * fn is called straight away if seq is already durable, and otherwise by the server's
+     * thread at the end of the pass that makes it durable, so it should be quick. If the server
+     * shuts down or the logger is removed first, fn is called with false instead. Any number
+     * of callbacks can wait on a logger at once.
+     */
+    void onDurable(const FlushSequence & seq, DurableCallback & callback){
+        if(isDurable(seq)){
+            callback.fn(callback.arg, true);
+            return;
+        }
+        LocalLoggerBase * logger = seq.logger;
+        LogServerBase * worker = seq.worker;
+        callback.position = seq.position;
+        logger->_addWaiter(&callback);
+        // pairs with the server's stores to _stopped, _waitersClosed and the durable position.
+        if(worker == nullptr || worker->_stopped.load(std::memory_order_seq_cst)
+            || logger->_waitersClosed.load(std::memory_order_seq_cst))
+        {
+            // nothing else will call it.
+            logger->_callWaiters(true);
+        }else if(isDurable(seq)){
+            // the server passed seq before it saw the callback.
+            worker->_waitersDue.store(true, std::memory_order_seq_cst);
+            worker->_onDumpAvail();
+        }
+    }
+
+    /**
+     * @brief Write every entry that hasn't been printed yet to sink in the binary format, e.g.
+     * from a crash signal handler. See installCrashHandler() in quicklog_posix.h.
+     * 
+     * Async-signal-safe as long as Sink::write() is, e.g. a quiet FdSink. Nothing is formatted:
+     * #QUICKLOG and #QUICKLOG_SITE entries are written as in BinarySink, other entries as
+     * just their format string. serializer types are written as their encoded bytes in hex,
+     * without calling their format(). Includes entries in LocalLogger buffers that haven't been
+     * flushed. State is only read, so entries the server was printing at the time may be
+     * repeated, and an entry being logged by a crashed thread may be cut short.
+     * 
+     * Strings logged as plain pointers are read when they're written, so if one is no
+     * longer valid that is another crash.
+     * 
+     * @return false if another crashDump() is already in progress.
+     */
+    template<class CrashSink>
+    bool crashDump(CrashSink & sink){
+        if(crashing.exchange(true)){
+            return false;
+        }
+        crashBinary.reset();
+        crashBinary.signalSafe = true;
+        OutputBuffer out{crashStaging, sizeof(crashStaging), &writeToCrashSink<CrashSink>, &sink, &crashBinary};
+        const size_t n = nLoggers.load(std::memory_order_acquire);
+        for(size_t i=0; i<n && i<maxLoggers; i++){
+            if(LocalLoggerBase * logger = localLoggers[i].load(std::memory_order_acquire)){
+                logger->crashDump(&out, workers[slotWorkers[i].load(std::memory_order_relaxed)].clock);
+            }
+        }
+        out.flush();
+        crashing.store(false);
+        return true;
+    }
+
+    /**
+     * @brief Print entries from all loggers in timestamp order instead of a buffer at a time.
+     * Requires #QUICKLOG_TIMESTAMPS. Call before starting the server.
+     * 
+     * Each pass the server merges the oldest unprinted entry of every logger, printing
+     * entries once they're at least windowNs old, so that entries logged around the same
+     * time on other threads have a chance to arrive first. An entry that arrives later
+     * than that, e.g. from a LocalLogger buffer that took longer to fill, is printed out
+     * of order. Entries newer than windowNs wait for a later pass, so PlatformImpl::wait()
+     * should return periodically. With several workers, each one's output is ordered
+     * separately.
+     * 
+     * Timestamps from different threads are only comparable if the #QUICKLOG_TIMESTAMP()
+     * counter is synchronized across CPUs, e.g. an invariant TSC.
+     */
+    void mergeByTimestamp(uint64_t windowNs){
+        if(!QUICKLOG_TIMESTAMPS){
+            QUICKLOG_ERROR("LogServer::mergeByTimestamp() requires QUICKLOG_TIMESTAMPS.\n");
+            return;
+        }
+        merge = true;
+        mergeWindowNs = windowNs;
+    }
+
+    /**
+     * @brief Print entries sitting in a LocalLogger buffer that hasn't been flush()'d once
+     * the server has seen them waiting for maxAgeNs. Call before starting the server.
+     * 
+     * The producer doesn't have to do anything, its buffer is read while it carries on
+     * logging into it, so rare entries appear within about maxAgeNs without flushing after
+     * each one. PlatformImpl::wait() has to return at least that often for the server to
+     * notice, e.g. TimedPoll, or an AdaptiveWait with a shorter parkTimeoutNs. Not for
+     * loggers using OverwriteOldest, which only hand over whole buffers. RingLocalLogger
+     * entries are printed straight away regardless.
+     */
+    void autoFlush(uint64_t maxAgeNs){
+        autoFlushNs = maxAgeNs;
+    }
+
+    /**
+     * @brief The counters of one worker so far. Can be called from any thread. See #QUICKLOG_STATS.
+     */
+    ServerStats stats(size_t worker) const{
+        const typename Worker::Counters & counters = workers[worker].counters;
+        ServerStats stats;
+        stats.wakeups = counters.wakeups.load(std::memory_order_relaxed);
+        stats.passes = counters.passes.load(std::memory_order_relaxed);
+        stats.entries = counters.entries.load(std::memory_order_relaxed);
+        stats.busyNs = counters.busyNs.load(std::memory_order_relaxed);
+        stats.maxPassNs = counters.maxPassNs.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    /**
+     * @brief The counters of all workers added up, and the longest pass of any of them.
+     */
+    ServerStats stats() const{
+        ServerStats total = {};
+        for(size_t i=0; i<numWorkers; i++){
+            const ServerStats stats = this->stats(i);
+            total.wakeups += stats.wakeups;
+            total.passes += stats.passes;
+            total.entries += stats.entries;
+            total.busyNs += stats.busyNs;
+            total.maxPassNs = std::max(total.maxPassNs, stats.maxPassNs);
+        }
+        return total;
+    }
+
+    /**
+     * @brief Copy LocalLoggerBase::stats() of up to max registered loggers into out, e.g. to
+     * export them periodically. Can be called from any thread, without allocating.
+     * 
+     * Lock-free, but a removeLogger() that overlaps waits for it to finish reading that
+     * logger, so the logger can't be destroyed while it's being read.
+     * 
+     * @return The number of loggers copied.
+     */
+    size_t loggerStats(LoggerStats *out, size_t max){
+        size_t copied = 0;
+        const size_t n = nLoggers.load(std::memory_order_acquire);
+        for(size_t i=0; i<n && i<maxLoggers && copied<max; i++){
+            // pairs with removeLogger().
+            std::atomic<uint32_t> & readers = slotReaders[i][slotGens[i].load(std::memory_order_acquire) & 1];
+            readers.fetch_add(1, std::memory_order_acq_rel);
+            if(LocalLoggerBase * logger = localLoggers[i].load(std::memory_order_acquire)){
+                out[copied++] = logger->stats();
+            }
+            readers.fetch_sub(1, std::memory_order_release);
         }
-        logger.server = this;
-        platform.unlock();
+        return copied;
     }
 
     /**
-     * @brief Cause the LogServer thread to finish printing any available log entries and exit.
+     * @brief Cause the LogServer threads to finish printing any available log entries and exit.
      * 
      */
     void shutdown(){
         run = false;
-        platform.notify();
+        for(Worker & worker : workers){
+            worker.platform.notify();
+        }
     }
 
     /**
-     * @brief main() function for LogServer thread.
+     * @brief main() function for LogServer thread. Runs worker 0.
      * 
      * @param arg pointer to a LogServer instance.
      */
     static void* process(void *arg){
         auto self = static_cast< LogServer* >(arg);
-        self->_process();
+        self->workers[0]._process();
+        return nullptr;
+    }
+
+    /**
+     * @brief main() function for the thread of each worker, when there are several.
+     * \code{.cpp}
+     * for(size_t i=0; i<N_WORKERS; i++){
+     *     threads.emplace_back(g_server.processWorker, g_server.worker(i));
+     * }
+     * \endcode
+     * 
+     * @param arg worker(i).
+     */
+    static void* processWorker(void *arg){
+        static_cast< Worker* >(arg)->_process();
         return nullptr;
     }
 
+    /**
+     * @brief Argument for processWorker().
+     */
+    void * worker(size_t i){
+        return &workers[i];
+    }
+
 private:
-    void _process(){
-        while(run){
-            platform.wait();
-            _dumpAll();
+
+    enum SlotState : uint8_t{
+        // not handed out yet, or handed out by the nLoggers increment.
+        slotNew,
+        slotUsed,
+        slotFree
+    };
+
+    template<class CrashSink>
+    static void writeToCrashSink(void *sink, const char *data, size_t size){
+        static_cast<CrashSink*>(sink)->write(data, size);
+    }
+
+    /** @param worker The worker the slot must belong to, or numWorkers for any. */
+    size_t freeSlot(size_t worker){
+        const size_t n = nLoggers.load(std::memory_order_relaxed);
+        for(size_t i=0; i<n && i<maxLoggers; i++){
+            uint8_t state = slotFree;
+            if(slotStates[i].load(std::memory_order_acquire) == slotFree &&
+                    (worker == numWorkers || slotWorkers[i].load(std::memory_order_relaxed) == worker) &&
+                    slotStates[i].compare_exchange_strong(state, slotUsed, std::memory_order_acquire)){
+                return i;
+            }
         }
-        _dumpAll();
+        return maxLoggers;
     }
 
-    void _dumpAll(){
-        platform.lock();
-        bool didSomething;
-        do{
-            didSomething = false;
-            for(size_t i=0; i<nLoggers; i++){
-                didSomething |= localLoggers[i]->dump();
+    void releaseSlot(size_t slot){
+        LocalLoggerBase * logger = localLoggers[slot].load(std::memory_order_relaxed);
+        if(logger){
+            memset(logger->_crash.magic, 0, sizeof(logger->_crash.magic));
+        }
+        localLoggers[slot].store(nullptr, std::memory_order_relaxed);
+        slotStates[slot].store(slotFree, std::memory_order_release);
+    }
+
+    struct MergeHead{
+        uint64_t ticks;
+        LocalLoggerBase * logger;
+
+        bool operator<(const MergeHead & other) const{
+            // std::push_heap() makes a max-heap.
+            return static_cast<int64_t>(ticks - other.ticks) > 0;
+        }
+    };
+
+    template<class S, class = void>
+    struct IsBinary : std::false_type{};
+
+    template<class S>
+    struct IsBinary<S, typename std::enable_if<S::binary>::type> : std::true_type{};
+
+    typedef typename std::conditional<IsBinary<Sink>::value, BinaryState, char>::type BinaryStateType;
+
+    static BinaryState * binaryState(BinaryState & state){
+        return &state;
+    }
+
+    static BinaryState * binaryState(char &){
+        return nullptr;
+    }
+
+    template<class S>
+    static OutputWindow sinkWindow(void *sink, bool boundary){
+        return static_cast<S*>(sink)->window(boundary);
+    }
+
+    /** @brief Sink::window(bool boundary) if the sink can be written into directly. */
+    template<class S>
+    static constexpr auto windowFunc(int) -> decltype(std::declval<S&>().window(false), OutputBuffer::WindowFunc()){
+        return &sinkWindow<S>;
+    }
+
+    template<class S>
+    static constexpr OutputBuffer::WindowFunc windowFunc(long){
+        return nullptr;
+    }
+
+    /**
+     * @brief A drain thread, and what the loggers it owns notify.
+     */
+    class Worker : public LogServerBase{
+    public:
+        void _process(){
+            if(QUICKLOG_TIMESTAMPS || QUICKLOG_STATS){
+                clock.calibrate();
+            }
+            while(server().run){
+                waitFor(platform, [this]{ return _pass() || !server().run; }, 0);
+                statAdd(counters.wakeups);
+                _pass();
+            }
+            _dumpAll(true);
+            _stopped.store(true, std::memory_order_seq_cst);
+            // entries logged from now on won't be printed.
+            _callWaiters(true);
+            // wake any removeLogger() still waiting.
+            _notifySpace();
+        }
+
+        /** @brief Print what's available, returning whether there was anything. */
+        bool _pass(){
+            if(QUICKLOG_TIMESTAMPS || QUICKLOG_STATS){
+                clock.update();
+            }
+            const uint64_t start = QUICKLOG_STATS ? QUICKLOG_TIMESTAMP() : 0;
+            const bool any = _dumpAll();
+            if(_waitersDue.load(std::memory_order_relaxed) && _waitersDue.exchange(false)){
+                _callWaiters(false);
+            }
+            if(QUICKLOG_STATS && any){
+                const uint64_t ns = clock.nanosecondsIn(QUICKLOG_TIMESTAMP() - start);
+                statAdd(counters.passes);
+                statAdd(counters.busyNs, ns);
+                statMax(counters.maxPassNs, ns);
+            }
+            return any;
+        }
+
+        bool _dumpAll(bool final = false){
+            OutputBuffer * out = Sink::buffered ? &output : nullptr;
+            if(server().merge){
+                return _mergeAll(out, final);
+            }
+            const uint64_t now = autoFlushNow();
+            bool any = false;
+            bool didSomething;
+            do{
+                didSomething = false;
+                const size_t n = server().nLoggers.load(std::memory_order_relaxed);
+                for(size_t i=0; i<n && i<maxLoggers; i++){
+                    // null if the slot is another worker's, or handed out but not published yet.
+                    LocalLoggerBase * logger = _logger(i);
+                    if(logger && now){
+                        logger->takeStale(now, server().autoFlushNs);
+                    }
+                    const uint64_t printed = logger ? logger->_printed() : 0;
+                    if(logger && logger->_removing.load(std::memory_order_acquire)){
+                        while(logger->dump(out, clock)){}
+                        statAdd(counters.entries, logger->_printed() - printed);
+                        _retire(out, i, logger);
+                        didSomething = true;
+                    }else if(logger){
+                        didSomething |= logger->dump(out, clock);
+                        statAdd(counters.entries, logger->_printed() - printed);
+                    }
+                    if(out && logger){
+                        out->boundary();
+                    }
+                }
+                if(didSomething){
+                    _notifySpace();
+                }
+                any |= didSomething;
+            }while(didSomething);
+            if(out){
+                out->flush(true);
+            }
+            if(any){
+                _markDurable();
+            }
+            return any;
+        }
+
+        /**
+         * @brief k-way merge of the loggers' entries by timestamp, for mergeByTimestamp().
+         * 
+         * @param final print everything, ignoring the reorder window.
+         */
+        bool _mergeAll(OutputBuffer *out, bool final){
+            const uint64_t now = autoFlushNow();
+            bool any = false;
+            bool freed = false;
+            do{
+                freed = false;
+                size_t nHeads = 0;
+                const size_t n = server().nLoggers.load(std::memory_order_relaxed);
+                for(size_t i=0; i<n && i<maxLoggers; i++){
+                    LocalLoggerBase * logger = _logger(i);
+                    if(logger && now){
+                        logger->takeStale(now, server().autoFlushNs);
+                    }
+                    if(logger){
+                        const bool removing = logger->_removing.load(std::memory_order_acquire);
+                        if(const uint8_t *record = logger->peek()){
+                            mergeHeads[nHeads++] = MergeHead{recordTicks(record), logger};
+                        }else if(removing){
+                            _retire(out, i, logger);
+                            freed = true;
+                        }
+                    }
+                }
+                std::make_heap(mergeHeads.begin(), mergeHeads.begin() + nHeads);
+
+                const uint64_t cutoff = QUICKLOG_TIMESTAMP() - clock.ticksIn(server().mergeWindowNs);
+                while(nHeads){
+                    std::pop_heap(mergeHeads.begin(), mergeHeads.begin() + nHeads);
+                    MergeHead & head = mergeHeads[nHeads - 1];
+                    if(!final && static_cast<int64_t>(head.ticks - cutoff) > 0){
+                        break;
+                    }
+                    freed |= head.logger->pop(out, clock);
+                    statAdd(counters.entries);
+                    any = true;
+                    if(out){
+                        out->boundary();
+                    }
+                    if(const uint8_t *record = head.logger->peek()){
+                        head.ticks = recordTicks(record);
+                        std::push_heap(mergeHeads.begin(), mergeHeads.begin() + nHeads);
+                    }else{
+                        --nHeads;
+                    }
+                }
+
+                if(freed){
+                    _notifySpace();
+                }
+            // on the final pass, keep going until producers freed by this one are done.
+            }while(final && freed);
+            if(out){
+                out->flush(true);
+            }
+            if(any){
+                _markDurable();
+            }
+            return any;
+        }
+
+        /** @brief The time for takeStale(), or 0 if autoFlush() is off. */
+        uint64_t autoFlushNow(){
+            if(!server().autoFlushNs){
+                return 0;
+            }
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /** @brief Once the pass's output is with the sink, tell waitDurable() and onDurable(). */
+        void _markDurable(){
+            const size_t n = server().nLoggers.load(std::memory_order_relaxed);
+            for(size_t i=0; i<n && i<maxLoggers; i++){
+                if(LocalLoggerBase * logger = _logger(i)){
+                    logger->_markDurable();
+                }
+            }
+            _notifySpace();
+        }
+
+        /** @brief Call each logger's onDurable() callbacks that are due, or with final all of them. */
+        void _callWaiters(bool final){
+            const size_t n = server().nLoggers.load(std::memory_order_relaxed);
+            for(size_t i=0; i<n && i<maxLoggers; i++){
+                if(LocalLoggerBase * logger = _logger(i)){
+                    logger->_callWaiters(final);
+                }
+            }
+        }
+
+        void _notifySpace(){
+            // pairs with the fence in Block::onFull().
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(_spaceWaiters.load(std::memory_order_relaxed)){
+                notifySpace(platform, 0);
+            }
+        }
+
+        void _onDumpAvail(){
+            platform.notify();
+        }
+
+        /** @brief Give up the slot of a removeLogger()'d logger that's been printed. */
+        void _retire(OutputBuffer *out, size_t slot, LocalLoggerBase * logger){
+            // the logger's entries reach the sink before removeLogger() returns.
+            if(out){
+                out->flush(true);
+            }
+            logger->_markDurable();
+            logger->_waitersClosed.store(true, std::memory_order_seq_cst);
+            logger->_callWaiters(true);
+            server().releaseSlot(slot);
+            logger->_removed.store(true, std::memory_order_release);
+        }
+
+        void _waitForSpace(){
+            waitSpace(platform, 0);
+        }
+
+        LogServer & server(){
+            return *m_server;
+        }
+
+        size_t index() const{
+            return m_index;
+        }
+
+        /** @brief The logger in a slot if this worker drains it, otherwise null. */
+        LocalLoggerBase * _logger(size_t slot){
+            LocalLoggerBase * logger = server().localLoggers[slot].load(std::memory_order_acquire);
+            if(numWorkers > 1 && logger && server().slotWorkers[slot].load(std::memory_order_relaxed) != m_index){
+                return nullptr;
             }
-        }while(didSomething);
-        platform.unlock();
+            return logger;
+        }
+
+        static void writeToSink(void *sink, const char *data, size_t size){
+            static_cast<Sink*>(sink)->write(data, size);
+        }
+
+        /** @brief For LogServer::stats(). Only written by the worker's thread. */
+        struct Counters{
+            std::atomic<uint64_t> wakeups{0};
+            std::atomic<uint64_t> passes{0};
+            std::atomic<uint64_t> entries{0};
+            std::atomic<uint64_t> busyNs{0};
+            std::atomic<uint64_t> maxPassNs{0};
+        };
+
+        LogServer * m_server = nullptr;
+        size_t m_index = 0;
+        Counters counters;
+        PlatformImpl platform;
+        TimestampClock clock;
+        std::array<MergeHead, (maxLoggers + numWorkers - 1) / numWorkers> mergeHeads;
+        Sink outputSink;
+        char staging[Sink::buffered ? stagingSize : 1];
+        BinaryStateType binary;
+        OutputBuffer output{staging, sizeof(staging), &writeToSink, &outputSink, binaryState(binary), windowFunc<Sink>(0)};
+    };
+
+    // null if free, or handed out but not published yet.
+    std::array<std::atomic<LocalLoggerBase*>, maxLoggers> localLoggers{};
+    std::array<std::atomic<uint8_t>, maxLoggers> slotStates{};
+    // the worker that drains each slot, see addLogger().
+    std::array<std::atomic<size_t>, maxLoggers> slotWorkers{};
+    std::atomic<size_t> nLoggers{0};
+    std::atomic<bool> run{true};
+    bool merge = false;
+    uint64_t mergeWindowNs = 0;
+    uint64_t autoFlushNs = 0;
+    size_t (*chooseWorker)() = nullptr;
+    std::array<Worker, numWorkers> workers;
+    // loggerStats() calls in progress, for removeLogger().
+    // loggerStats() calls reading each slot, counted by the parity of its generation, which
+    // removeLogger() bumps so that it only waits for the ones that started before it.
+    std::array<std::atomic<uint32_t>, maxLoggers> slotGens{};
+    std::array<std::array<std::atomic<uint32_t>, 2>, maxLoggers> slotReaders{};
+
+    std::atomic<bool> crashing{false};
+    BinaryState crashBinary;
+    char crashStaging[4096];
+};
+
+
+
+/**
+ * @brief A logger that registers itself with a LogServer when it's constructed and
+ * removes itself, once the server has printed everything, when it's destroyed. Meant
+ * for thread_local loggers in threads that come and go.
+ * \code{.cpp}
+ * thread_local quicklog::ScopedLocalLogger<decltype(g_server), quicklog::LocalLogger<4, 4096>> t_logger(g_server);
+ * \endcode
+ * 
+ * @tparam Server The LogServer type.
+ * @tparam Logger LocalLogger or RingLocalLogger.
+ */
+template<class Server, class Logger>
+class ScopedLocalLogger : public Logger{
+public:
+    /** @param args Passed on to Logger's constructor, e.g. for LocalLogger<dynamic, dynamic>. */
+    template<class ...Args>
+    explicit ScopedLocalLogger(Server & server, Args && ... args): Logger(std::forward<Args>(args) ...), m_server(server){
+        m_server.addLogger(static_cast<Logger&>(*this));
+    }
+
+    ~ScopedLocalLogger(){
+        m_server.removeLogger(static_cast<Logger&>(*this));
+    }
+
+    ScopedLocalLogger(const ScopedLocalLogger &) = delete;
+    ScopedLocalLogger & operator=(const ScopedLocalLogger &) = delete;
+
+private:
+    Server & m_server;
+};
+
+
+#if QUICKLOG_COROUTINES
+/**
+ * @brief Awaitable returned by durable().
+ */
+template<class Server>
+class DurableAwaiter{
+public:
+    DurableAwaiter(Server & server, const FlushSequence & seq): m_server(server), m_seq(seq){}
+
+    bool await_ready() const{
+        return m_server.isDurable(m_seq);
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle){
+        m_handle = handle;
+        m_callback.fn = &resume;
+        m_callback.arg = this;
+        m_server.onDurable(m_seq, m_callback);
+        // whichever of this and resume() comes second resumes the coroutine.
+        return !m_arrived.exchange(true, std::memory_order_acq_rel);
     }
 
+    /** @return false if the server shut down or the logger was removed first. */
+    bool await_resume() const{
+        return m_durable;
+    }
 
-    void _onDumpAvail(){
-        platform.notify();
+private:
+    static void resume(void *arg, bool durable){
+        DurableAwaiter * self = static_cast<DurableAwaiter*>(arg);
+        const std::coroutine_handle<> handle = self->m_handle;
+        self->m_durable = durable;
+        if(self->m_arrived.exchange(true, std::memory_order_acq_rel)){
+            handle.resume();
+        }
     }
 
-    std::array<LocalLoggerBase*, maxLoggers> localLoggers;
-    size_t nLoggers = 0;
-    volatile bool run = true;
-    PlatformImpl platform;
+    Server & m_server;
+    FlushSequence m_seq;
+    DurableCallback m_callback;
+    std::coroutine_handle<> m_handle;
+    bool m_durable = true;
+    std::atomic<bool> m_arrived{false};
 };
 
+/**
+ * @brief co_await the entries before seq, from a logger's flush(), being passed to the sink.
+ * See LogServer::onDurable().
+ * \code{.cpp}
+ * co_await quicklog::durable(g_server, m_logger.flush());
+ * \endcode
+ * 
+ * The coroutine is resumed on the server's thread, unless they were already durable, so
+ * it should hand itself back to an executor of its own before doing anything slow. The
+ * co_await evaluates to false if the server shut down or the logger was removed first.
+ */
+template<class Server>
+DurableAwaiter<Server> durable(Server & server, const FlushSequence & seq){
+    return DurableAwaiter<Server>(server, seq);
+}
+#endif
 
 } // namespace quicklog
 
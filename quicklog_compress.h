@@ -0,0 +1,441 @@
+#pragma once
+
+/**
+ * @file quicklog_compress.h
+ *
+ * A LogServer sink that compresses the server's output on a thread of its own and writes
+ * it out from a third, so that formatting, compression and I/O all overlap.
+ *
+ * The server's staging buffer is copied into one of two batches. When a batch is full, or
+ * the compression thread has nothing else to do, it's handed over and the server moves on
+ * to the other one. The compression thread compresses each batch into one of two output
+ * buffers as a frame of its own, and the writer thread copies the frames into a block of
+ * writeSize bytes, which is written with one call at a multiple of writeSize into the file.
+ * Under load batches fill up and compress well, while a quiet server hands over what it has
+ * straight away, so entries aren't held back.
+ *
+ * LZ4 and zstd both read concatenated frames, so the output can be decompressed with
+ * <tt>lz4 -d</tt> or <tt>zstd -d</tt>, and the binary format piped on to quicklog_decode.
+ *
+ * Requires liblz4 (-llz4), and libzstd (-lzstd) for ZstdCodec, which is only compiled
+ * with -DQUICKLOG_ZSTD=1.
+ *
+ */
+
+#include "quicklog_posix.h"
+
+#include <lz4frame.h>
+
+/**
+ * @def QUICKLOG_ZSTD
+ */
+/**
+ * @brief Define as 1 to compile ZstdCodec. Defaults to 0.
+ */
+#ifndef QUICKLOG_ZSTD
+#define QUICKLOG_ZSTD 0
+#endif
+
+#if QUICKLOG_ZSTD
+#include <zstd.h>
+#endif
+
+
+namespace quicklog{
+
+
+/**
+ * @brief CompressedSink codec writing each batch as an LZ4 frame. The default.
+ *
+ * @tparam level LZ4F compression level. 0 is fast LZ4, 3 and up use LZ4 HC.
+ */
+template<int level = 0>
+class Lz4Codec{
+public:
+    /** @brief The most bytes compress() writes for size bytes. */
+    static size_t bound(size_t size){
+        const LZ4F_preferences_t prefs = preferences(0);
+        return LZ4F_compressFrameBound(size, &prefs);
+    }
+
+    /** @return the compressed size, or 0 on error. */
+    size_t compress(void *dest, size_t capacity, const void *src, size_t size){
+        const LZ4F_preferences_t prefs = preferences(size);
+        const size_t n = LZ4F_compressFrame(dest, capacity, src, size, &prefs);
+        return LZ4F_isError(n) ? 0 : n;
+    }
+
+private:
+    static LZ4F_preferences_t preferences(size_t size){
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+        prefs.frameInfo.contentSize = size;
+        prefs.compressionLevel = level;
+        return prefs;
+    }
+};
+
+
+#if QUICKLOG_ZSTD
+/**
+ * @brief CompressedSink codec writing each batch as a zstd frame. Smaller and slower than
+ * Lz4Codec. Requires #QUICKLOG_ZSTD.
+ *
+ * @tparam level zstd compression level, 1 to 22.
+ */
+template<int level = 3>
+class ZstdCodec{
+public:
+    ZstdCodec() : m_context(ZSTD_createCCtx()){}
+
+    ~ZstdCodec(){
+        ZSTD_freeCCtx(m_context);
+    }
+
+    ZstdCodec(const ZstdCodec &) = delete;
+    ZstdCodec & operator=(const ZstdCodec &) = delete;
+
+    /** @brief The most bytes compress() writes for size bytes. */
+    static size_t bound(size_t size){
+        return ZSTD_compressBound(size);
+    }
+
+    /** @return the compressed size, or 0 on error. */
+    size_t compress(void *dest, size_t capacity, const void *src, size_t size){
+        const size_t n = ZSTD_compressCCtx(m_context, dest, capacity, src, size, level);
+        return ZSTD_isError(n) ? 0 : n;
+    }
+
+private:
+    ZSTD_CCtx *m_context;
+};
+#endif
+
+
+/**
+ * @brief LogServer sink that compresses batches of output with Codec on one thread and
+ * writes them to a file descriptor from another. See quicklog_compress.h.
+ *
+ * Call setFd() before the server starts, and run processCompress() and processWrite() on
+ * threads of their own. Once the server's threads have exited, finish() lets them write
+ * out the rest and return.
+ * \code{.cpp}
+ * quicklog::LogServer<MAX_LOCAL_LOGGERS, quicklog::AdaptiveWait, quicklog::CompressedSink<>> g_server;
+ * \endcode
+ * \code{.cpp}
+ * g_server.sink().setFd(open("app.log.lz4", O_WRONLY | O_CREAT | O_TRUNC, 0644));
+ * std::thread compressThread(g_server.sink().processCompress, &g_server.sink());
+ * std::thread writeThread(g_server.sink().processWrite, &g_server.sink());
+ * std::thread serverThread(g_server.process, &g_server);
+ * ...
+ * g_server.shutdown();
+ * serverThread.join();
+ * g_server.sink().finish();
+ * compressThread.join();
+ * writeThread.join();
+ * \endcode
+ * Wrap it in BinarySink to compress the binary format instead of text.
+ *
+ * Writes to a file start at its offset when setFd() is called and are writeSize bytes at a
+ * multiple of writeSize from there. When there's nothing more to write for now, the writer
+ * writes the part of the block it has and writes the whole block again once it's filled,
+ * so every write still starts on a block. Pipes and sockets get the part block and the
+ * writer starts a new one.
+ *
+ * If the compression thread falls two batches behind, the server waits for it.
+ *
+ * @tparam Codec e.g. Lz4Codec or ZstdCodec.
+ * @tparam batchSize bytes of output compressed as one frame, at most.
+ * @tparam writeSize bytes written by each full write, a multiple of the page size.
+ * @tparam Parker how the stages wait for each other, see SpinYieldPark.
+ */
+template<class Codec = Lz4Codec<>, size_t batchSize = 4 * 1024 * 1024, size_t writeSize = 1024 * 1024,
+    class Parker = DefaultParker>
+class CompressedSink{
+public:
+    static constexpr bool buffered = true;
+    static_assert(writeSize % 4096 == 0, "writeSize must be a multiple of the page size.");
+
+    CompressedSink() = default;
+    CompressedSink(const CompressedSink &) = delete;
+    CompressedSink & operator=(const CompressedSink &) = delete;
+
+    ~CompressedSink(){
+        for(size_t i=0; i<2; i++){
+            free(m_batches[i]);
+            free(m_frames[i]);
+        }
+        free(m_block);
+    }
+
+    /** @brief Write to fd, allocating the buffers. Call once, before the server starts. */
+    void setFd(int fd){
+        m_fd = fd;
+        const off_t offset = lseek(fd, 0, SEEK_CUR);
+        m_seekable = offset >= 0;
+        m_blockOffset = m_seekable ? offset : 0;
+        m_frameCapacity = Codec::bound(batchSize);
+        for(size_t i=0; i<2; i++){
+            m_batches[i] = static_cast<char*>(malloc(batchSize));
+            m_frames[i] = static_cast<uint8_t*>(malloc(m_frameCapacity));
+        }
+        void *block = nullptr;
+        if(posix_memalign(&block, 4096, writeSize) != 0){
+            block = nullptr;
+        }
+        m_block = static_cast<uint8_t*>(block);
+        if(!m_batches[0] || !m_batches[1] || !m_frames[0] || !m_frames[1] || !m_block){
+            QUICKLOG_ERROR("CompressedSink failed to allocate its buffers.\n");
+        }
+    }
+
+    /** @brief Called by the server. Drops output if setFd() hasn't been called. */
+    void write(const char *data, size_t size){
+        if(!m_block){
+            return;
+        }
+        reclaimTail();
+        while(size){
+            if(m_fill == 0){
+                // the batch being filled must have been compressed.
+                waitFor(m_consumed, [this](uint32_t consumed){ return m_handed - consumed < 2; });
+            }
+            char *batch = m_batches[m_handed & 1];
+            const size_t n = size < batchSize - m_fill ? size : batchSize - m_fill;
+            memcpy(batch + m_fill, data, n);
+            m_fill += n;
+            data += n;
+            size -= n;
+            if(m_fill == batchSize){
+                handOver(0);
+            }
+        }
+        if(m_fill){
+            // hand over the rest now if the compressor's idle, or when it's done otherwise.
+            leaveTail();
+        }
+    }
+
+    /**
+     * @brief Hand the last batch to the compression thread, and let processCompress() and
+     * processWrite() return once everything's written. Call after the server's threads
+     * have exited.
+     */
+    void finish(){
+        reclaimTail();
+        handOver(finishedBit);
+    }
+
+    /** @brief main() function for the compression thread. */
+    static void processCompress(CompressedSink *sink){
+        sink->compressAll();
+    }
+
+    /** @brief main() function for the writer thread. */
+    static void processWrite(CompressedSink *sink){
+        sink->writeAll();
+    }
+
+private:
+    // set in m_handedWord by finish(), and in m_compressed once the last frame is ready.
+    static constexpr uint32_t finishedBit = 0x80000000;
+    static constexpr uint64_t parkTimeoutNs = 100000000;
+
+    /** @brief Wait until done(word) is true. */
+    template<class Done>
+    uint32_t waitFor(std::atomic<uint32_t> & word, Done done){
+        for(;;){
+            const uint32_t value = word.load(std::memory_order_acquire);
+            if(done(value)){
+                return value;
+            }
+            m_parker.park(word, value, parkTimeoutNs);
+        }
+    }
+
+    void publish(std::atomic<uint32_t> & word, uint32_t value){
+        word.store(value, std::memory_order_release);
+        m_parker.wake(word);
+    }
+
+    /**
+     * @brief Leave the partial batch for the compression thread to take once it's finished
+     * the one it's on, unless it's already idle, so a quiet server doesn't hold it back.
+     */
+    void leaveTail(){
+        m_sizes[m_handed & 1] = m_fill;
+        // pairs with takeTail() after the compressor publishes m_consumed.
+        m_tail.store(tailLeft, std::memory_order_seq_cst);
+        if(m_consumed.load(std::memory_order_seq_cst) == m_handed){
+            reclaimTail();
+            if(m_fill){
+                handOver(0);
+            }
+        }
+    }
+
+    /** @brief Take back the partial batch leaveTail() left, or count it if the compressor took it. */
+    void reclaimTail(){
+        if(m_tail.load(std::memory_order_relaxed) != tailNone
+            && m_tail.exchange(tailNone, std::memory_order_acq_rel) == tailTaken)
+        {
+            ++m_handed;
+            m_fill = 0;
+        }
+    }
+
+    /** @brief Called by the compression thread once it's idle. */
+    bool takeTail(){
+        uint32_t left = tailLeft;
+        return m_tail.compare_exchange_strong(left, tailTaken, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Whether m_handedWord has batches after next. It's one behind next after the
+     * compressor takes a tail, until the server's next write().
+     */
+    static bool handedAfter(uint32_t handed, uint32_t next){
+        const uint32_t ahead = (handed - next) & ~finishedBit;
+        return ahead != 0 && ahead < finishedBit / 2;
+    }
+
+    void handOver(uint32_t flags){
+        m_sizes[m_handed & 1] = m_fill;
+        if(m_fill){
+            ++m_handed;
+            m_fill = 0;
+        }
+        publish(m_handedWord, m_handed | flags);
+    }
+
+    void compressAll(){
+        uint32_t next = 0;
+        for(;;){
+            if(!handedAfter(m_handedWord.load(std::memory_order_acquire), next) && !takeTail()){
+                const uint32_t handed = waitFor(m_handedWord, [next](uint32_t handed){
+                    return handedAfter(handed, next) || (handed & finishedBit);
+                });
+                if(!handedAfter(handed, next)){
+                    break;
+                }
+            }
+            waitFor(m_written, [next](uint32_t written){ return next - written < 2; });
+            const size_t i = next & 1;
+            m_frameSizes[i] = m_codec.compress(m_frames[i], m_frameCapacity, m_batches[i], m_sizes[i]);
+            if(!m_frameSizes[i]){
+                QUICKLOG_ERROR("CompressedSink failed to compress a batch.\n");
+            }
+            ++next;
+            m_consumed.store(next, std::memory_order_seq_cst);
+            m_parker.wake(m_consumed);
+            publish(m_compressed, next);
+        }
+        publish(m_compressed, next | finishedBit);
+    }
+
+    void writeAll(){
+        uint32_t next = 0;
+        for(;;){
+            const uint32_t compressed = m_compressed.load(std::memory_order_acquire);
+            if((compressed & ~finishedBit) == next){
+                if(compressed & finishedBit){
+                    break;
+                }
+                writePart();
+                m_parker.park(m_compressed, compressed, parkTimeoutNs);
+                continue;
+            }
+            append(m_frames[next & 1], m_frameSizes[next & 1]);
+            ++next;
+            publish(m_written, next);
+        }
+        writePart();
+    }
+
+    void append(const uint8_t *data, size_t size){
+        while(size){
+            const size_t n = size < writeSize - m_blockFill ? size : writeSize - m_blockFill;
+            memcpy(m_block + m_blockFill, data, n);
+            m_blockFill += n;
+            data += n;
+            size -= n;
+            if(m_blockFill == writeSize){
+                writeUpTo(writeSize);
+                m_blockOffset += writeSize;
+                m_blockFill = 0;
+                m_blockWritten = 0;
+            }
+        }
+    }
+
+    /** @brief Write what there is of the current block. */
+    void writePart(){
+        if(m_blockFill != m_blockWritten){
+            writeUpTo(m_blockFill);
+        }
+    }
+
+    void writeUpTo(size_t end){
+        if(m_seekable){
+            // from the start of the block again, so every write starts on one.
+            writeBlock(m_block, end, m_blockOffset);
+        }else{
+            writeBlock(m_block + m_blockWritten, end - m_blockWritten, 0);
+        }
+        m_blockWritten = end;
+    }
+
+    void writeBlock(const uint8_t *data, size_t size, off_t offset){
+        while(size){
+            const ssize_t n = m_seekable ? pwrite(m_fd, data, size, offset) : ::write(m_fd, data, size);
+            if(n < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                QUICKLOG_ERROR("CompressedSink write() failed.\n");
+                return;
+            }
+            data += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    // server side
+    int m_fd = -1;
+    bool m_seekable = false;
+    char *m_batches[2] = {nullptr, nullptr};
+    size_t m_sizes[2] = {0, 0};
+    size_t m_fill = 0;
+    uint32_t m_handed = 0;
+    Parker m_parker;
+
+    // compression thread
+    Codec m_codec;
+    uint8_t *m_frames[2] = {nullptr, nullptr};
+    size_t m_frameSizes[2] = {0, 0};
+    size_t m_frameCapacity = 0;
+
+    // writer thread
+    uint8_t *m_block = nullptr;
+    size_t m_blockFill = 0;
+    // how much of the block is already in the file.
+    size_t m_blockWritten = 0;
+    off_t m_blockOffset = 0;
+
+    // batches handed over, and finishedBit.
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> m_handedWord{0};
+    // the partial batch at m_handed, see leaveTail().
+    enum : uint32_t{ tailNone, tailLeft, tailTaken };
+    std::atomic<uint32_t> m_tail{tailNone};
+    // batches compressed, so their buffers can be filled again.
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> m_consumed{0};
+    // frames ready to be written, and finishedBit.
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> m_compressed{0};
+    // frames written, so their buffers can be compressed into again.
+    alignas(QUICKLOG_CACHE_LINE) std::atomic<uint32_t> m_written{0};
+};
+
+
+}
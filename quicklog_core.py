@@ -0,0 +1,401 @@
+#!/usr/bin/env python3
+"""Recover the entries quicklog hadn't printed yet from a core file.
+
+Finds the decoder table and every registered LocalLogger and RingLocalLogger in
+the core's memory by their magic strings (see quicklog::detail::crash), then
+writes their unprinted entries, including those in buffers that were never
+flushed, in the binary format read by quicklog_decode:
+
+    ./quicklog_core.py core.1234 > pending.qlog
+    ./quicklog_decode -l pending.qlog
+
+Only needs the core, and the files it maps (the executable and its libraries)
+at the paths they had when it was dumped, for strings in read-only memory.
+Use --map OLD=NEW to read a mapped file from somewhere else. Like
+LogServer::crashDump(), entries not logged via QUICKLOG or QUICKLOG_SITE are
+written as just their format string.
+"""
+
+import argparse
+import struct
+import sys
+
+TABLE_MAGIC = b"quicklog-table \0"
+LOGGER_MAGIC = b"quicklog-logger\0"
+
+PT_LOAD = 1
+PT_NOTE = 4
+NT_FILE = 0x46494C45
+
+# quicklog::detail::crash
+FIELD_KIND, FIELD_START_TICKS, FIELD_START_NS, FIELD_NS_PER_TICK, FIELD_FIRST = range(5)
+NUM_FIELDS = 16
+KIND_BUFFERS = 1
+KIND_RING = 2
+
+# quicklog::detail::ArgStorage and ArgKind
+STORAGE_VALUE, STORAGE_STRING, STORAGE_COPIED_STRING, STORAGE_COPIED_BYTES, STORAGE_NONE = range(5)
+KIND_STRING = 5
+
+# quicklog::detail::RecordLayout::Placement
+PLACEMENT_NATURAL, PLACEMENT_IN_PLACE, PLACEMENT_PACKED = range(3)
+
+NULL_STRING = 0xFFFFFFFF
+MAX_STRING = 1 << 16
+
+
+def aligned(n, align):
+    return (n + align - 1) // align * align
+
+
+class Core:
+    """Reads a process's memory from its core file and the files it had mapped."""
+
+    def __init__(self, path, remap):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError("%s isn't an ELF file" % path)
+        self.ptr = 8 if self.data[4] == 2 else 4
+        self.endian = "<" if self.data[5] == 1 else ">"
+        self.remap = remap
+        self.files = {}
+        self.loads = []
+        self.mappings = []
+
+        if self.ptr == 8:
+            phoff, = self.unpack("Q", 0x20)
+            phentsize, phnum = self.unpack("HH", 0x36)
+        else:
+            phoff, = self.unpack("I", 0x1C)
+            phentsize, phnum = self.unpack("HH", 0x2A)
+        for i in range(phnum):
+            off = phoff + i * phentsize
+            if self.ptr == 8:
+                ptype, _, offset, vaddr, _, filesz, memsz = self.unpack("IIQQQQQ", off)
+            else:
+                ptype, offset, vaddr, _, filesz, memsz = self.unpack("IIIIII", off)
+            if ptype == PT_LOAD:
+                self.loads.append((vaddr, offset, filesz, memsz))
+            elif ptype == PT_NOTE:
+                self.parse_notes(offset, filesz)
+
+    def unpack(self, fmt, offset, data=None):
+        fmt = self.endian + fmt
+        return struct.unpack_from(fmt, self.data if data is None else data, offset)
+
+    def parse_notes(self, offset, size):
+        end = offset + size
+        while offset + 12 <= end:
+            namesz, descsz, ntype = self.unpack("III", offset)
+            desc = offset + 12 + aligned(namesz, 4)
+            if ntype == NT_FILE:
+                self.parse_files(self.data[desc:desc + descsz])
+            offset = desc + aligned(descsz, 4)
+
+    def parse_files(self, desc):
+        word = "Q" if self.ptr == 8 else "I"
+        count, page = self.unpack(word * 2, 0, desc)
+        pos = 2 * self.ptr
+        entries = []
+        for _ in range(count):
+            entries.append(self.unpack(word * 3, pos, desc))
+            pos += 3 * self.ptr
+        names = desc[pos:].split(b"\0")
+        for (start, end, pages), name in zip(entries, names):
+            self.mappings.append((start, end, pages * page, name.decode(errors="replace")))
+
+    def mapped_file(self, name):
+        for old, new in self.remap:
+            if name.startswith(old):
+                name = new + name[len(old):]
+        if name not in self.files:
+            try:
+                with open(name, "rb") as f:
+                    self.files[name] = f.read()
+            except OSError:
+                sys.stderr.write("quicklog_core: can't read %s\n" % name)
+                self.files[name] = None
+        return self.files[name]
+
+    def read(self, address, size):
+        """size bytes at address, or None if they aren't in the core or a mapped file."""
+        for vaddr, offset, filesz, memsz in self.loads:
+            if vaddr <= address and address + size <= vaddr + filesz:
+                start = offset + address - vaddr
+                return self.data[start:start + size]
+            if filesz < memsz and vaddr + filesz <= address and address + size <= vaddr + memsz and \
+                    not self.in_mapping(address):
+                return bytes(size)
+        for start, end, offset, name in self.mappings:
+            if start <= address and address + size <= end:
+                data = self.mapped_file(name)
+                if data is None:
+                    return None
+                pos = offset + address - start
+                return data[pos:pos + size]
+        return None
+
+    def in_mapping(self, address):
+        return any(start <= address < end for start, end, _, _ in self.mappings)
+
+    def value(self, fmt, address):
+        data = self.read(address, struct.calcsize(self.endian + fmt))
+        if data is None:
+            raise ValueError("address 0x%x isn't in the core" % address)
+        return struct.unpack(self.endian + fmt, data)[0]
+
+    def pointer(self, address):
+        return self.value("Q" if self.ptr == 8 else "I", address)
+
+    def string(self, address):
+        """The null terminated string at address, or None."""
+        if address == 0:
+            return None
+        out = b""
+        while len(out) < MAX_STRING:
+            # a byte at a time near the end of a mapping.
+            chunk = self.read(address + len(out), 64) or self.read(address + len(out), 1)
+            if chunk is None:
+                break
+            end = chunk.find(b"\0")
+            if end >= 0:
+                return out + chunk[:end]
+            out += chunk
+        return out
+
+    def find(self, magic):
+        """Addresses of every 8 byte aligned copy of magic in the core's memory."""
+        for vaddr, offset, filesz, _ in self.loads:
+            segment = self.data[offset:offset + filesz]
+            pos = segment.find(magic)
+            while pos >= 0:
+                if (vaddr + pos) % 8 == 0:
+                    yield vaddr + pos
+                pos = segment.find(magic, pos + 1)
+
+
+class Table:
+    """quicklog::detail::DecoderTable"""
+
+    def __init__(self, core, address):
+        self.core = core
+        self.header_size = core.value("H", address + 16)
+        self.count = core.value("H", address + 18)
+        max_types = core.value("I", address + 20)
+        if self.header_size not in (4, 12) or self.count > max_types:
+            raise ValueError("not a decoder table")
+        funcs = aligned(address + 24, core.ptr)
+        self.sites_array = funcs + max_types * core.ptr
+        self.layouts_array = self.sites_array + max_types * core.ptr
+        self.sites = {}
+        self.layouts = {}
+
+    def site(self, decoder):
+        """(line, level, argTypes, file, format) of a QUICKLOG_SITE decoder, or None."""
+        if decoder not in self.sites:
+            self.sites[decoder] = None
+            address = self.core.pointer(self.sites_array + decoder * self.core.ptr)
+            if address:
+                p = self.core.ptr
+                fmt, file = self.core.pointer(address), self.core.pointer(address + p)
+                line = self.core.value("I", address + 2 * p)
+                level, num_args = self.core.value("B", address + 2 * p + 4), self.core.value("B", address + 2 * p + 5)
+                arg_types = self.core.pointer(address + aligned(2 * p + 6, p))
+                types = [(self.core.value("B", arg_types + 2 * i), self.core.value("B", arg_types + 2 * i + 1))
+                         for i in range(num_args)]
+                if fmt:
+                    self.sites[decoder] = (line, level, types, self.core.string(file), self.core.string(fmt))
+        return self.sites[decoder]
+
+    def layout(self, decoder):
+        """(placement, payloadAlign, [(offset, kind, size, storage)]) of a decoder, or None."""
+        if decoder not in self.layouts:
+            self.layouts[decoder] = None
+            address = self.core.pointer(self.layouts_array + decoder * self.core.ptr)
+            if address:
+                placement = self.core.value("B", address)
+                align = self.core.value("B", address + 1)
+                num_args = self.core.value("B", address + 2)
+                args_address = self.core.pointer(address + self.core.ptr)
+                args = []
+                for i in range(num_args):
+                    a = args_address + 6 * i
+                    args.append((self.core.value("H", a), self.core.value("B", a + 2),
+                                 self.core.value("B", a + 3), self.core.value("B", a + 4)))
+                self.layouts[decoder] = (placement, align, args)
+        return self.layouts[decoder]
+
+
+class Writer:
+    """Writes the binary format, see quicklog::detail::binary."""
+
+    def __init__(self, core, table, out):
+        self.core = core
+        self.table = table
+        self.out = out
+        self.timestamps = table.header_size == 12
+        self.described = set()
+        self.count = 0
+        self.put("4sHHI", b"QLOG", 2, 0x0102, 1 if self.timestamps else 0)
+
+    def put(self, fmt, *values):
+        self.out.write(struct.pack(self.core.endian + fmt, *values))
+
+    def put_string(self, s):
+        if s is None:
+            self.put("I", NULL_STRING)
+        else:
+            self.put("I", len(s))
+            self.out.write(s)
+
+    def record(self, address, clock):
+        """Write the record at address, returning its size."""
+        decoder, size = self.core.value("H", address), self.core.value("H", address + 2)
+        layout = self.table.layout(decoder)
+        if layout is None:
+            # padding.
+            return size
+        placement, align, args = layout
+        header = self.table.header_size
+        if placement == PLACEMENT_NATURAL:
+            payload = address + aligned(address + header, align) - address
+        elif placement == PLACEMENT_IN_PLACE:
+            payload = address + aligned(header, align)
+        else:
+            payload = address + header
+        ns = clock(self.core.value("Q", address + 4)) if self.timestamps else None
+
+        site = self.table.site(decoder)
+        if site is None:
+            self.put("c", b"T")
+            if ns is not None:
+                self.put("Q", ns)
+            if args and args[0][3] == STORAGE_STRING:
+                self.out.write(self.core.string(self.core.pointer(payload + args[0][0])) or b"")
+            self.out.write(b"\0")
+        else:
+            line, level, types, file, fmt = site
+            if decoder not in self.described:
+                self.put("cHIBB", b"D", decoder, line, level, len(types))
+                for kind, type_size in types:
+                    self.put("BB", kind, type_size)
+                self.put_string(file)
+                self.put_string(fmt)
+                self.described.add(decoder)
+            self.put("cH", b"E", decoder)
+            if ns is not None:
+                self.put("Q", ns)
+            for offset, kind, arg_size, storage in args[1:]:
+                self.arg(address, payload + offset, kind, arg_size, storage)
+        self.count += 1
+        return size
+
+    def arg(self, record, address, kind, size, storage):
+        if storage == STORAGE_STRING:
+            self.put_string(self.core.string(self.core.pointer(address)))
+        elif storage in (STORAGE_COPIED_STRING, STORAGE_COPIED_BYTES):
+            offset, length = self.core.value("H", address), self.core.value("H", address + 2)
+            data = self.core.read(record + offset, length) or b""
+            self.put_string(data if storage == STORAGE_COPIED_STRING else data.hex().encode())
+        elif storage == STORAGE_VALUE:
+            self.out.write(self.core.read(address, size) or bytes(size))
+
+
+def clock_of(core, fields):
+    if not fields[FIELD_START_TICKS]:
+        return lambda ticks: 0
+    start_ticks = core.value("Q", fields[FIELD_START_TICKS])
+    start_ns = core.value("q", fields[FIELD_START_NS])
+    ns_per_tick = core.value("d", fields[FIELD_NS_PER_TICK])
+
+    def clock(ticks):
+        delta = (ticks - start_ticks + (1 << 63)) % (1 << 64) - (1 << 63)
+        return (start_ns + int(delta * ns_per_tick)) % (1 << 64)
+    return clock
+
+
+def dump_buffers(core, writer, f, clock):
+    """LocalLogger::crashDump()"""
+    num_buffers, stride, count0, pos0, data0, write_index, read_index, record_pos, records_left, puts, gets = \
+        f[FIELD_FIRST:FIELD_FIRST + 11]
+    size_t = "Q" if core.ptr == 8 else "I"
+    write_index = core.value("I", write_index)
+    read_index = core.value("I", read_index)
+    record_pos = core.value(size_t, record_pos)
+    records_left = core.value(size_t, records_left)
+    full = (core.value("I", puts) - core.value("I", gets)) % (1 << 32) == num_buffers
+    first = write_index if full else write_index + 1
+    for i in range(num_buffers):
+        index = (first + i) % num_buffers
+        data = data0 + index * stride
+        if index == read_index and records_left:
+            pos, n = record_pos, records_left
+        else:
+            pos, n = 0, core.value(size_t, count0 + index * stride)
+        for _ in range(n):
+            size = writer.record(data + pos, clock)
+            if size == 0:
+                break
+            pos += size
+
+
+def dump_ring(core, writer, f, clock):
+    """RingLocalLogger::crashDump()"""
+    ring_size, ring, read_pos, committed = f[FIELD_FIRST:FIELD_FIRST + 4]
+    size_t = "Q" if core.ptr == 8 else "I"
+    end = core.value(size_t, committed)
+    pos = core.value(size_t, read_pos)
+    while pos != end and end - pos <= ring_size:
+        offset = pos & (ring_size - 1)
+        if ring_size - offset < 4:
+            pos += ring_size - offset
+            continue
+        size = writer.record(ring + offset, clock)
+        if size == 0:
+            return
+        pos += size
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Recover unprinted quicklog entries from a core file.")
+    parser.add_argument("core")
+    parser.add_argument("-o", "--output", help="write here instead of stdout")
+    parser.add_argument("--map", action="append", default=[], metavar="OLD=NEW",
+                        help="read mapped files under OLD from NEW instead")
+    args = parser.parse_args()
+
+    core = Core(args.core, [tuple(m.split("=", 1)) for m in args.map])
+    table = None
+    for address in core.find(TABLE_MAGIC):
+        try:
+            table = Table(core, address)
+            break
+        except ValueError:
+            continue
+    if table is None:
+        sys.exit("quicklog_core: no quicklog decoder table in %s" % args.core)
+
+    out = open(args.output, "wb") if args.output else sys.stdout.buffer
+    writer = Writer(core, table, out)
+    loggers = 0
+    for address in core.find(LOGGER_MAGIC):
+        fields = [core.value("Q", address + 16 + 8 * i) for i in range(NUM_FIELDS)]
+        kind = fields[FIELD_KIND]
+        if kind not in (KIND_BUFFERS, KIND_RING):
+            continue
+        try:
+            clock = clock_of(core, fields)
+            if kind == KIND_BUFFERS:
+                dump_buffers(core, writer, fields, clock)
+            else:
+                dump_ring(core, writer, fields, clock)
+            loggers += 1
+        except ValueError as e:
+            sys.stderr.write("quicklog_core: logger at 0x%x: %s\n" % (address, e))
+    out.flush()
+    sys.stderr.write("quicklog_core: %d entries from %d loggers\n" % (writer.count, loggers))
+
+
+if __name__ == "__main__":
+    main()
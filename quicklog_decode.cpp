@@ -0,0 +1,293 @@
+#include "quicklog.h"
+#include <vector>
+#include <string>
+
+/**
+ * @file quicklog_decode.cpp
+ * 
+ * @brief Offline decoder for logs written by a LogServer with a BinarySink.
+ * 
+ * Renders the entries as text, formatting them the same way the LogServer's buffered
+ * sinks would have. Must run on a host with the same byte order and type sizes as
+ * the one that wrote the log.
+ * 
+ * Compile with @code {.sh}
+ * g++ -Wall -std=c++14 -O2 quicklog_decode.cpp -o quicklog_decode
+ * @endcode
+ * 
+ * Usage: @code{.sh}
+ * ./quicklog_decode [-l] [FILE]
+ * @endcode
+ * Reads stdin if no FILE is given. -l prefixes each entry with its level, file and line.
+ * 
+ */
+
+using namespace quicklog::detail;
+
+
+struct Site{
+    bool known = false;
+    std::string file;
+    uint32_t line = 0;
+    quicklog::Level level = quicklog::Level::info;
+    std::vector<ArgType> argTypes;
+    std::string format;
+    std::vector<FormatSegment> segments;
+};
+
+
+static const char *levelName(quicklog::Level level){
+    switch(level){
+    case quicklog::Level::trace: return "TRACE";
+    case quicklog::Level::debug: return "DEBUG";
+    case quicklog::Level::info: return "INFO";
+    case quicklog::Level::warning: return "WARNING";
+    case quicklog::Level::error: return "ERROR";
+    case quicklog::Level::fatal: return "FATAL";
+    }
+    return "?";
+}
+
+
+class Decoder{
+public:
+    Decoder(FILE *in, bool prefix) : m_in(in), m_prefix(prefix) {}
+
+    int run(){
+        char magic[sizeof(binary::magic)];
+        uint16_t version, byteOrder;
+        uint32_t flags;
+        if(!read(magic, sizeof(magic)) || memcmp(magic, binary::magic, sizeof(magic)) != 0
+            || !readValue(version) || !readValue(byteOrder))
+        {
+            return fail("not a quicklog binary log");
+        }
+        if(byteOrder != binary::byteOrder){
+            return fail("written with a different byte order");
+        }
+        if(version != binary::version){
+            return fail("unsupported version");
+        }
+        if(!readValue(flags)){
+            return fail("not a quicklog binary log");
+        }
+        m_timestamps = flags & binary::timestampFlag;
+
+        BinaryFrame frame;
+        // a zero is the preallocated end of a file an MmapSink didn't get to close.
+        while(readValue(frame) && frame != BinaryFrame()){
+            bool ok;
+            switch(frame){
+            case BinaryFrame::dictionary: ok = readDictionary(); break;
+            case BinaryFrame::entry: ok = readEntry(); break;
+            case BinaryFrame::text: ok = readText(); break;
+            default: return fail("corrupt frame");
+            }
+            if(!ok){
+                return fail("truncated or corrupt log");
+            }
+        }
+        m_out.flush();
+        return 0;
+    }
+
+private:
+    int fail(const char *msg){
+        m_out.flush();
+        fprintf(stderr, "quicklog_decode: %s\n", msg);
+        return 1;
+    }
+
+    bool read(void *dest, size_t size){
+        return fread(dest, 1, size, m_in) == size;
+    }
+
+    template<typename T>
+    bool readValue(T & v){
+        return read(&v, sizeof(v));
+    }
+
+    bool readString(std::string & str, bool & isNull){
+        uint32_t length;
+        if(!readValue(length)){
+            return false;
+        }
+        isNull = length == binary::nullString;
+        str.resize(isNull ? 0 : length);
+        return isNull || read(&str[0], length);
+    }
+
+    bool readDictionary(){
+        uint16_t id;
+        uint8_t numArgs;
+        Site site;
+        bool isNull;
+        if(!readValue(id) || !readValue(site.line) || !readValue(site.level) || !readValue(numArgs)){
+            return false;
+        }
+        site.argTypes.resize(numArgs);
+        for(ArgType & arg : site.argTypes){
+            if(!readValue(arg.kind) || !readValue(arg.size)){
+                return false;
+            }
+        }
+        if(!readString(site.file, isNull) || !readString(site.format, isNull)){
+            return false;
+        }
+        if(!formatMatches(site.format.c_str(), site.argTypes.data(), site.argTypes.size())){
+            // written without the compile time check, e.g. by quicklog_drain for a ShmLogger::log().
+            std::string generic(genericFormatSize(site.format.c_str(), numArgs), 0);
+            genericFormat(site.format.c_str(), site.argTypes.data(), numArgs, &generic[0]);
+            site.format = generic.c_str();
+        }
+        site.segments.resize(countPercents(site.format.c_str()) + 1);
+        site.segments.resize(parseFormat(site.format.c_str(), site.segments.data()));
+        site.known = true;
+        if(id >= m_sites.size()){
+            m_sites.resize(id + 1);
+        }
+        m_sites[id] = std::move(site);
+        return true;
+    }
+
+    bool readArg(const ArgType & type, FormatArg & arg, std::string & str){
+        uint8_t raw[sizeof(long double)] = {};
+        if(type.kind == ArgKind::string){
+            bool isNull;
+            if(!readString(str, isNull)){
+                return false;
+            }
+            arg.p = isNull ? nullptr : str.c_str();
+            return true;
+        }
+        if(type.size > sizeof(raw) || !read(raw, type.size)){
+            return false;
+        }
+        switch(type.kind){
+        case ArgKind::signedInt:
+            switch(type.size){
+            case 1: arg.u = static_cast<unsigned long long>(*reinterpret_cast<int8_t*>(raw)); return true;
+            case 2: arg.u = static_cast<unsigned long long>(*reinterpret_cast<int16_t*>(raw)); return true;
+            case 4: arg.u = static_cast<unsigned long long>(*reinterpret_cast<int32_t*>(raw)); return true;
+            case 8: arg.u = static_cast<unsigned long long>(*reinterpret_cast<int64_t*>(raw)); return true;
+            }
+            return false;
+        case ArgKind::unsignedInt:
+            switch(type.size){
+            case 1: arg.u = *reinterpret_cast<uint8_t*>(raw); return true;
+            case 2: arg.u = *reinterpret_cast<uint16_t*>(raw); return true;
+            case 4: arg.u = *reinterpret_cast<uint32_t*>(raw); return true;
+            case 8: arg.u = *reinterpret_cast<uint64_t*>(raw); return true;
+            }
+            return false;
+        case ArgKind::floating:
+            if(type.size == sizeof(float)){
+                arg.d = *reinterpret_cast<float*>(raw);
+                return true;
+            }
+            if(type.size == sizeof(double)){
+                arg.d = *reinterpret_cast<double*>(raw);
+                return true;
+            }
+            return false;
+        case ArgKind::longDouble:
+            memcpy(&arg.ld, raw, sizeof(arg.ld));
+            return type.size == sizeof(long double);
+        case ArgKind::pointer:
+            memcpy(&arg.p, raw, sizeof(arg.p));
+            return type.size == sizeof(void*);
+        default:
+            return false;
+        }
+    }
+
+    bool readTimestamp(){
+        uint64_t ns;
+        if(!m_timestamps){
+            return true;
+        }
+        if(!readValue(ns)){
+            return false;
+        }
+        writeTimestamp(m_out, ns);
+        return true;
+    }
+
+    bool readEntry(){
+        uint16_t id;
+        if(!readValue(id) || id >= m_sites.size() || !m_sites[id].known || !readTimestamp()){
+            return false;
+        }
+        const Site & site = m_sites[id];
+        m_args.resize(site.argTypes.size());
+        m_strings.resize(site.argTypes.size());
+        for(size_t i=0; i<site.argTypes.size(); i++){
+            if(!readArg(site.argTypes[i], m_args[i], m_strings[i])){
+                return false;
+            }
+        }
+        if(m_prefix){
+            char prefix[64];
+            const int n = snprintf(prefix, sizeof(prefix), "[%s] ", levelName(site.level));
+            m_out.write(prefix, n);
+            m_out.write(site.file.data(), site.file.size());
+            const int m = snprintf(prefix, sizeof(prefix), ":%u: ", site.line);
+            m_out.write(prefix, m);
+        }
+        formatPlanned(m_out, site.format.c_str(), site.segments.data(), site.segments.size(), m_args.data());
+        return true;
+    }
+
+    bool readText(){
+        if(!readTimestamp()){
+            return false;
+        }
+        int c;
+        while((c = fgetc(m_in)) != EOF){
+            if(c == 0){
+                return true;
+            }
+            const char ch = static_cast<char>(c);
+            m_out.write(&ch, 1);
+        }
+        return false;
+    }
+
+    static void writeStdout(void *, const char *data, size_t size){
+        fwrite(data, 1, size, stdout);
+    }
+
+    FILE * m_in;
+    bool m_prefix;
+    bool m_timestamps = false;
+    std::vector<Site> m_sites;
+    std::vector<FormatArg> m_args;
+    std::vector<std::string> m_strings;
+    char m_buffer[64*1024];
+    OutputBuffer m_out{m_buffer, sizeof(m_buffer), &writeStdout, nullptr};
+};
+
+
+int main(int argc, char **argv){
+    bool prefix = false;
+    const char *path = nullptr;
+    for(int i=1; i<argc; i++){
+        if(strcmp(argv[i], "-l") == 0){
+            prefix = true;
+        }else{
+            path = argv[i];
+        }
+    }
+
+    FILE *in = path ? fopen(path, "rb") : stdin;
+    if(!in){
+        perror(path);
+        return 1;
+    }
+    static Decoder decoder(in, prefix);
+    const int status = decoder.run();
+    if(path){
+        fclose(in);
+    }
+    return status;
+}
@@ -0,0 +1,525 @@
+#define QUICKLOG_TIMESTAMPS 1
+#include "quicklog_shm.h"
+#include <dirent.h>
+#include <signal.h>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @file quicklog_drain.cpp
+ *
+ * @brief Sidecar that drains every ShmRegion on the host into one binary log.
+ *
+ * Polls the rings of each region about once a millisecond and writes their entries
+ * in the binary format read by quicklog_decode, without formatting anything. Entries
+ * logged via #QUICKLOG_SITE keep their file and line. Other entries are written with
+ * their format string too, and the region's name as their file. Regions are found by
+ * name in /dev/shm, and unlinked once the process that created them has destroyed them,
+ * or died, and they've been drained. Must run on the same host as the producers, since
+ * their timestamps are converted with the drain's own clock.
+ *
+ * Compile with @code {.sh}
+ * g++ -Wall -std=c++14 -O2 quicklog_drain.cpp -o quicklog_drain -lrt
+ * @endcode
+ *
+ * Usage: @code{.sh}
+ * ./quicklog_drain [-o FILE] [-p PREFIX] [NAME ...]
+ * ./quicklog_drain | ./quicklog_decode
+ * @endcode
+ * Drains the regions called NAME, or every region whose name starts with PREFIX,
+ * "quicklog." by default, until interrupted. Writes to stdout if no FILE is given.
+ *
+ */
+
+using namespace quicklog::detail;
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int){
+    stopRequested = 1;
+}
+
+
+static int64_t monotonicNs(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+/** @brief A decoder's dictionary entry, as read from the region. */
+struct DictEntry{
+    bool known = false;
+    bool hasLayout = false;
+    bool hasSite = false;
+    uint8_t placement = 0;
+    uint8_t payloadAlign = 1;
+    std::vector<CrashArg> args;
+    uint32_t line = 0;
+    quicklog::Level level = quicklog::Level::info;
+    std::vector<ArgType> argTypes;
+    std::string file;
+    std::string format;
+    // the drain's id for the site, if it has one and it's been described.
+    int id = -1;
+};
+
+
+struct Region{
+    std::string name;
+    uint8_t *base = nullptr;
+    size_t size = 0;
+    shm::RegionHeader *header = nullptr;
+    std::vector<DictEntry> dict;
+    // the drain's ids for entries without a site, by format string and argument types.
+    std::map<std::pair<std::string, std::string>, uint16_t> formats;
+
+    shm::RingHeader * ring(uint32_t i){
+        return reinterpret_cast<shm::RingHeader*>(base + header->ringsAt + i * header->ringStride);
+    }
+
+    uint8_t * ringData(uint32_t i){
+        return reinterpret_cast<uint8_t*>(ring(i)) + shm::roundUp(sizeof(shm::RingHeader));
+    }
+};
+
+
+/** @brief Reads a dictionary entry, failing rather than reading past end. */
+class DictReader{
+public:
+    DictReader(const uint8_t *pos, const uint8_t *end) : m_pos(pos), m_end(end) {}
+
+    template<typename T>
+    bool get(T & v){
+        if(static_cast<size_t>(m_end - m_pos) < sizeof(v)){
+            return false;
+        }
+        memcpy(&v, m_pos, sizeof(v));
+        m_pos += sizeof(v);
+        return true;
+    }
+
+    bool getString(std::string & str){
+        uint32_t length;
+        if(!get(length)){
+            return false;
+        }
+        if(length == binary::nullString){
+            str.clear();
+            return true;
+        }
+        if(static_cast<size_t>(m_end - m_pos) < length){
+            return false;
+        }
+        str.assign(reinterpret_cast<const char*>(m_pos), length);
+        m_pos += length;
+        return true;
+    }
+
+private:
+    const uint8_t *m_pos;
+    const uint8_t *m_end;
+};
+
+
+class Drain{
+public:
+    Drain(FILE *out, std::string prefix, std::vector<std::string> names)
+        : m_file(out), m_prefix(std::move(prefix)), m_names(std::move(names))
+    {
+        m_clock.calibrate();
+    }
+
+    int run(){
+        int64_t lastScan = 0;
+        while(true){
+            const bool stopping = stopRequested;
+            const int64_t now = monotonicNs();
+            if(now - lastScan >= scanIntervalNs){
+                scan();
+                lastScan = now;
+            }
+            m_clock.update();
+            bool any = false;
+            for(size_t i=0; i<m_regions.size(); ){
+                bool finished;
+                any |= drain(*m_regions[i], finished);
+                if(finished){
+                    detach(*m_regions[i], true);
+                    m_regions.erase(m_regions.begin() + i);
+                }else{
+                    i++;
+                }
+            }
+            m_out.flush();
+            fflush(m_file);
+            if(stopping){
+                break;
+            }
+            if(!any){
+                const timespec pause = {0, pollIntervalNs};
+                nanosleep(&pause, nullptr);
+            }
+        }
+        for(auto & region : m_regions){
+            detach(*region, false);
+        }
+        return 0;
+    }
+
+private:
+    static constexpr int64_t scanIntervalNs = 100000000;
+    static constexpr long pollIntervalNs = 1000000;
+
+    void scan(){
+        if(!m_names.empty()){
+            for(const std::string & name : m_names){
+                attach(name);
+            }
+            return;
+        }
+        DIR *dir = opendir("/dev/shm");
+        if(!dir){
+            return;
+        }
+        while(dirent *e = readdir(dir)){
+            if(strncmp(e->d_name, m_prefix.c_str(), m_prefix.size()) == 0){
+                attach(std::string("/") + e->d_name);
+            }
+        }
+        closedir(dir);
+    }
+
+    void attach(const std::string & name){
+        for(auto & region : m_regions){
+            if(region->name == name){
+                return;
+            }
+        }
+        const int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if(fd < 0){
+            return;
+        }
+        struct stat st;
+        void *base = MAP_FAILED;
+        if(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(shm::RegionHeader)){
+            base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if(base == MAP_FAILED){
+            return;
+        }
+
+        std::unique_ptr<Region> region(new Region);
+        region->name = name;
+        region->base = static_cast<uint8_t*>(base);
+        region->size = st.st_size;
+        region->header = reinterpret_cast<shm::RegionHeader*>(base);
+        const shm::RegionHeader & h = *region->header;
+        // not finished being created yet, try again on the next scan.
+        const bool ready = memcmp(h.magic, shm::magic, sizeof(shm::magic)) == 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(!ready || h.version != shm::version
+            || static_cast<uint64_t>(h.ringsAt) + static_cast<uint64_t>(h.numRings) * h.ringStride > region->size)
+        {
+            if(ready){
+                fprintf(stderr, "quicklog_drain: %s: unsupported region\n", name.c_str());
+            }
+            munmap(base, region->size);
+            return;
+        }
+        region->dict.resize(h.maxTypes);
+        m_regions.push_back(std::move(region));
+    }
+
+    void detach(Region & region, bool unlink){
+        if(unlink){
+            shm_unlink(region.name.c_str());
+        }
+        munmap(region.base, region.size);
+    }
+
+    /**
+     * @brief Write out everything committed to region's rings so far.
+     *
+     * @param finished Set if the region's creator has gone and it's been drained for the last time.
+     * @return true if there was anything to write.
+     */
+    bool drain(Region & region, bool & finished){
+        const shm::RegionHeader & h = *region.header;
+        // read before draining, so nothing logged before the region was destroyed is missed.
+        const bool gone = h.detached.load(std::memory_order_acquire)
+            || (kill(static_cast<pid_t>(h.pid), 0) != 0 && errno == ESRCH);
+        bool any = false;
+        for(uint32_t i=0; i<h.numRings; i++){
+            shm::RingHeader & ring = *region.ring(i);
+            const uint32_t state = ring.state.load(std::memory_order_acquire);
+            if(state == shm::ringFree && !gone){
+                continue;
+            }
+            any |= drainRing(region, ring, region.ringData(i));
+            uint32_t released = shm::ringReleased;
+            if(state == released){
+                ring.state.compare_exchange_strong(released, shm::ringFree, std::memory_order_release);
+            }
+        }
+        finished = gone;
+        return any;
+    }
+
+    bool drainRing(Region & region, shm::RingHeader & ring, const uint8_t *data){
+        const size_t ringSize = region.header->ringSize;
+        uint64_t pos = ring.readPos.load(std::memory_order_relaxed);
+        const uint64_t end = ring.committed.load(std::memory_order_acquire);
+        if(pos == end){
+            return false;
+        }
+        while(pos != end){
+            const size_t offset = pos & (ringSize - 1);
+            if(ringSize - offset < sizeof(RecordHeader)){
+                pos += ringSize - offset;
+                continue;
+            }
+            RecordHeader header;
+            memcpy(&header, &data[offset], sizeof(header));
+            if(header.size < sizeof(RecordHeader) || header.size > ringSize - offset || end - pos > ringSize){
+                fprintf(stderr, "quicklog_drain: %s: corrupt ring, skipping it\n", region.name.c_str());
+                pos = end;
+                break;
+            }
+            if(header.decoder != region.header->paddingDecoder){
+                record(region, &data[offset], header);
+            }
+            pos += header.size;
+        }
+        ring.readPos.store(pos, std::memory_order_release);
+        return true;
+    }
+
+    /** @brief The dictionary entry for decoder id, or nullptr if it hasn't been published. */
+    DictEntry * lookup(Region & region, uint16_t id){
+        if(id >= region.dict.size()){
+            return nullptr;
+        }
+        DictEntry & entry = region.dict[id];
+        if(entry.known){
+            return &entry;
+        }
+        const shm::RegionHeader & h = *region.header;
+        const auto *offsets = reinterpret_cast<const std::atomic<uint32_t>*>(region.base + h.offsetsAt);
+        const uint32_t offset = offsets[id].load(std::memory_order_acquire);
+        if(offset < h.dictAt || offset >= h.dictAt + h.dictSize){
+            return nullptr;
+        }
+        DictReader in(region.base + offset, region.base + h.dictAt + h.dictSize);
+        uint8_t flags, numArgs;
+        if(!in.get(flags)){
+            return nullptr;
+        }
+        entry.hasLayout = flags & shm::entryFlag;
+        entry.hasSite = flags & shm::siteFlag;
+        if(entry.hasLayout){
+            if(!in.get(entry.placement) || !in.get(entry.payloadAlign) || !in.get(numArgs) || !entry.payloadAlign){
+                return nullptr;
+            }
+            entry.args.resize(numArgs);
+            for(CrashArg & arg : entry.args){
+                if(!in.get(arg.offset) || !in.get(arg.type.kind) || !in.get(arg.type.size) || !in.get(arg.storage)){
+                    return nullptr;
+                }
+            }
+        }
+        if(entry.hasSite){
+            if(!in.get(entry.line) || !in.get(entry.level) || !in.get(numArgs)){
+                return nullptr;
+            }
+            entry.argTypes.resize(numArgs);
+            for(ArgType & type : entry.argTypes){
+                if(!in.get(type.kind) || !in.get(type.size)){
+                    return nullptr;
+                }
+            }
+            if(!in.getString(entry.file) || !in.getString(entry.format)){
+                return nullptr;
+            }
+        }
+        entry.known = true;
+        return &entry;
+    }
+
+    /** @brief A new id for the output, described by a dictionary frame. */
+    int describe(const std::string & file, uint32_t line, quicklog::Level level,
+                 const std::vector<ArgType> & argTypes, const std::string & format)
+    {
+        if(m_nextId > UINT16_MAX){
+            fprintf(stderr, "quicklog_drain: too many sites\n");
+            return -1;
+        }
+        const uint16_t id = static_cast<uint16_t>(m_nextId++);
+        std::string checked = format;
+        if(!formatMatches(format.c_str(), argTypes.data(), argTypes.size())){
+            // ShmLogger::log() formats aren't checked at compile time.
+            checked.assign(genericFormatSize(format.c_str(), argTypes.size()), 0);
+            genericFormat(format.c_str(), argTypes.data(), argTypes.size(), &checked[0]);
+            checked.resize(strlen(checked.c_str()));
+        }
+        beginFrame(m_out, BinaryFrame::dictionary);
+        writeValue(m_out, id);
+        writeValue(m_out, line);
+        writeValue(m_out, level);
+        writeValue(m_out, static_cast<uint8_t>(argTypes.size()));
+        for(const ArgType & type : argTypes){
+            writeValue(m_out, type.kind);
+            writeValue(m_out, type.size);
+        }
+        writeString(m_out, file.c_str());
+        writeString(m_out, checked.c_str());
+        return id;
+    }
+
+    void record(Region & region, const uint8_t *record, const RecordHeader & header){
+        DictEntry *entry = lookup(region, header.decoder);
+        if(entry == nullptr || !entry->hasLayout){
+            return;
+        }
+        const size_t headerSize = region.header->headerSize;
+        const uintptr_t address = reinterpret_cast<uintptr_t>(record);
+        const uint8_t *payload = record
+            + (entry->placement == RecordLayout::natural ? alignedSize(address + headerSize, entry->payloadAlign) - address
+            : entry->placement == RecordLayout::inPlace ? alignedSize(headerSize, entry->payloadAlign)
+            : headerSize);
+        uint64_t ticks = QUICKLOG_TIMESTAMP();
+        if(headerSize >= sizeof(RecordHeader) + sizeof(ticks)){
+            memcpy(&ticks, record + sizeof(RecordHeader), sizeof(ticks));
+        }
+        const uint64_t ns = m_clock.toNanoseconds(ticks);
+
+        int id = entry->id;
+        if(entry->hasSite){
+            if(id < 0){
+                id = entry->id = describe(entry->file, entry->line, entry->level, entry->argTypes, entry->format);
+            }
+        }else if(!entry->args.empty() && entry->args[0].storage == ArgStorage::copiedString){
+            std::pair<std::string, std::string> key;
+            copied(record, payload + entry->args[0].offset, key.first);
+            std::vector<ArgType> argTypes;
+            for(size_t i=1; i<entry->args.size(); i++){
+                if(entry->args[i].storage != ArgStorage::none){
+                    argTypes.push_back(entry->args[i].type);
+                }
+            }
+            // the same format can be logged with different argument types.
+            key.second.assign(reinterpret_cast<const char*>(argTypes.data()), argTypes.size() * sizeof(ArgType));
+            auto known = region.formats.find(key);
+            if(known != region.formats.end()){
+                id = known->second;
+            }else{
+                id = describe(region.name, 0, quicklog::Level::info, argTypes, key.first);
+                if(id >= 0){
+                    region.formats[key] = static_cast<uint16_t>(id);
+                }
+            }
+        }
+        if(id < 0){
+            // nothing to format it with.
+            beginFrame(m_out, BinaryFrame::text);
+            writeValue(m_out, ns);
+            m_out.write("", 1);
+            return;
+        }
+
+        beginFrame(m_out, BinaryFrame::entry);
+        writeValue(m_out, static_cast<uint16_t>(id));
+        writeValue(m_out, ns);
+        for(size_t i=1; i<entry->args.size(); i++){
+            writeStored(record, payload + entry->args[i].offset, entry->args[i]);
+        }
+    }
+
+    static void copied(const uint8_t *record, const uint8_t *stored, std::string & str){
+        CopiedBytes copy;
+        memcpy(&copy, stored, sizeof(copy));
+        str.assign(reinterpret_cast<const char*>(record + copy.offset), copy.size);
+    }
+
+    void writeStored(const uint8_t *record, const uint8_t *stored, const CrashArg & arg){
+        static const char digits[] = "0123456789abcdef";
+        std::string str;
+        switch(arg.storage){
+        case ArgStorage::value:
+            m_out.write(reinterpret_cast<const char*>(stored), arg.type.size);
+            break;
+        case ArgStorage::copiedString:
+            copied(record, stored, str);
+            writeValue(m_out, static_cast<uint32_t>(str.size()));
+            m_out.write(str.data(), str.size());
+            break;
+        case ArgStorage::copiedBytes:
+            copied(record, stored, str);
+            writeValue(m_out, static_cast<uint32_t>(2 * str.size()));
+            for(unsigned char c : str){
+                const char hex[2] = {digits[c >> 4], digits[c & 15]};
+                m_out.write(hex, 2);
+            }
+            break;
+        case ArgStorage::string:
+            // a pointer into another process.
+            writeValue(m_out, binary::nullString);
+            break;
+        case ArgStorage::none:
+            break;
+        }
+    }
+
+    static void writeFile(void *file, const char *data, size_t size){
+        fwrite(data, 1, size, static_cast<FILE*>(file));
+    }
+
+    FILE *m_file;
+    std::string m_prefix;
+    std::vector<std::string> m_names;
+    std::vector<std::unique_ptr<Region>> m_regions;
+    quicklog::TimestampClock m_clock;
+    int m_nextId = 0;
+    BinaryState m_binary;
+    char m_buffer[64*1024];
+    OutputBuffer m_out{m_buffer, sizeof(m_buffer), &writeFile, m_file, &m_binary};
+};
+
+
+int main(int argc, char **argv){
+    const char *path = nullptr;
+    std::string prefix = "quicklog.";
+    std::vector<std::string> names;
+    for(int i=1; i<argc; i++){
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+            path = argv[++i];
+        }else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc){
+            prefix = argv[++i];
+        }else{
+            names.push_back(argv[i][0] == '/' ? argv[i] : std::string("/") + argv[i]);
+        }
+    }
+
+    FILE *out = path ? fopen(path, "wb") : stdout;
+    if(!out){
+        perror(path);
+        return 1;
+    }
+    struct sigaction sa = {};
+    sa.sa_handler = &requestStop;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    static Drain drain(out, prefix, names);
+    const int status = drain.run();
+    if(path){
+        fclose(out);
+    }
+    return status;
+}
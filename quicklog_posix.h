@@ -0,0 +1,634 @@
+#pragma once
+
+/**
+ * @file quicklog_posix.h
+ * 
+ * Optional extras for POSIX platforms.
+ * 
+ */
+
+#include "quicklog.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+
+namespace quicklog{
+
+
+/**
+ * @brief LogServer sink. Entries are formatted with #QUICKLOG_FORMAT into the server's
+ * staging buffer, which is passed to a single write() each time it fills up and at the
+ * end of every pass over the loggers.
+ * 
+ * Writes to STDOUT_FILENO unless setFd() is called before the server starts.
+ */
+class FdSink{
+public:
+    static constexpr bool buffered = true;
+
+    void setFd(int fd){
+        m_fd = fd;
+    }
+
+    /**
+     * @brief Give up on a failed write() silently instead of calling #QUICKLOG_ERROR, which
+     * isn't async-signal-safe. For installCrashHandler().
+     */
+    void setQuiet(bool quiet){
+        m_quiet = quiet;
+    }
+
+    void write(const char *data, size_t size){
+        while(size){
+            const ssize_t n = ::write(m_fd, data, size);
+            if(n < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                if(!m_quiet){
+                    QUICKLOG_ERROR("FdSink write() failed.\n");
+                }
+                return;
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+private:
+    int m_fd = STDOUT_FILENO;
+    bool m_quiet = false;
+};
+
+
+/**
+ * @brief LogServer sink writing to memory mapped files. The server formats entries
+ * straight into the mapping, so printing them makes no syscalls and no copies.
+ * 
+ * Output is split into segments of about segmentSize bytes, named path.0, path.1, ...
+ * Each one is preallocated with posix_fallocate() and mapped when it's opened. The server
+ * moves on to the next segment at the end of the first pass after the current one fills
+ * up. A pass that doesn't fit grows the segment instead, so an entry is never split
+ * between files. In the binary format, each segment starts with its own header and
+ * dictionary frames, so it can be decoded on its own.
+ * 
+ * Segments are truncated to what was written when they're closed, so only the last one
+ * written before a crash ends in zeroes; quicklog_decode stops there.
+ * 
+ * Call setPath() before the server starts. With more than one worker, give each a path.
+ */
+class MmapSink{
+public:
+    static constexpr bool buffered = true;
+
+    MmapSink() = default;
+    MmapSink(const MmapSink &) = delete;
+    MmapSink & operator=(const MmapSink &) = delete;
+
+    ~MmapSink(){
+        closeSegment();
+    }
+
+    void setPath(const char *path, size_t segmentSize = 64 * 1024 * 1024){
+        snprintf(m_path, sizeof(m_path), "%s", path);
+        m_segmentSize = segmentSize < 2 * minWindow ? 2 * minWindow : segmentSize;
+    }
+
+    /** @brief madvise() advice for each mapping, e.g. MADV_SEQUENTIAL or MADV_HUGEPAGE. */
+    void setAdvice(int advice){
+        m_advice = advice;
+    }
+
+    /**
+     * @brief msync() flags, MS_ASYNC or MS_SYNC, to write each segment back with when it's
+     * closed. 0, the default, leaves it to the kernel.
+     */
+    void setSync(int flags){
+        m_sync = flags;
+    }
+
+    void write(const char *data, size_t size){
+        if(m_map && data == m_map + m_pos){
+            // formatted straight into window().
+            m_pos += size;
+            return;
+        }
+        while(size){
+            if(!reserve()){
+                return;
+            }
+            const size_t n = size < m_mapSize - m_pos ? size : m_mapSize - m_pos;
+            memcpy(m_map + m_pos, data, n);
+            m_pos += n;
+            data += n;
+            size -= n;
+        }
+    }
+
+    OutputWindow window(bool boundary){
+        if(!m_path[0]){
+            return OutputWindow{nullptr, 0, false};
+        }
+        bool newFile = false;
+        if(m_map == nullptr || (boundary && m_mapSize - m_pos < minWindow)){
+            closeSegment();
+            if(!openSegment()){
+                return OutputWindow{nullptr, 0, false};
+            }
+            newFile = true;
+        }else if(m_mapSize - m_pos < minWindow && !grow()){
+            return OutputWindow{nullptr, 0, false};
+        }
+        return OutputWindow{m_map + m_pos, m_mapSize - m_pos, newFile};
+    }
+
+private:
+    // the least room window() hands out, so entries are never truncated.
+    static constexpr size_t minWindow = 64 * 1024;
+
+    /** @brief Make sure there's room for at least one byte. */
+    bool reserve(){
+        if(m_map == nullptr){
+            if(!m_path[0]){
+                QUICKLOG_ERROR("MmapSink has no path.\n");
+                return false;
+            }
+            return openSegment();
+        }
+        return m_pos < m_mapSize || grow();
+    }
+
+    static bool allocate(int fd, size_t offset, size_t size){
+#ifdef __APPLE__
+        return ftruncate(fd, static_cast<off_t>(offset + size)) == 0;
+#else
+        const int error = posix_fallocate(fd, static_cast<off_t>(offset), static_cast<off_t>(size));
+        // e.g. a file system without fallocate(), where blocks are just allocated on first touch.
+        return error == 0 || ((error == EINVAL || error == EOPNOTSUPP)
+            && ftruncate(fd, static_cast<off_t>(offset + size)) == 0);
+#endif
+    }
+
+    bool map(size_t size){
+        void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if(map == MAP_FAILED){
+            QUICKLOG_ERROR("MmapSink mmap() failed.\n");
+            return false;
+        }
+        if(m_advice >= 0){
+            madvise(map, size, m_advice);
+        }
+        m_map = static_cast<char*>(map);
+        m_mapSize = size;
+        return true;
+    }
+
+    bool openSegment(){
+        char name[sizeof(m_path) + 16];
+        snprintf(name, sizeof(name), "%s.%u", m_path, m_segment++);
+        m_fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(m_fd < 0){
+            QUICKLOG_ERROR("MmapSink open() failed.\n");
+            return false;
+        }
+        m_pos = 0;
+        if(!allocate(m_fd, 0, m_segmentSize)){
+            QUICKLOG_ERROR("MmapSink posix_fallocate() failed.\n");
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        return map(m_segmentSize);
+    }
+
+    /** @brief Extend the current segment by a quarter of segmentSize. */
+    bool grow(){
+        const size_t size = m_mapSize + m_segmentSize / 4;
+        if(!allocate(m_fd, m_mapSize, size - m_mapSize)){
+            QUICKLOG_ERROR("MmapSink posix_fallocate() failed.\n");
+            return false;
+        }
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+        return map(size);
+    }
+
+    void closeSegment(){
+        if(m_map){
+            if(m_sync){
+                msync(m_map, m_pos, m_sync);
+            }
+            munmap(m_map, m_mapSize);
+            m_map = nullptr;
+        }
+        if(m_fd >= 0){
+            if(ftruncate(m_fd, static_cast<off_t>(m_pos)) != 0){
+                QUICKLOG_ERROR("MmapSink ftruncate() failed.\n");
+            }
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    char m_path[256] = {};
+    size_t m_segmentSize = 0;
+    int m_advice = -1;
+    int m_sync = 0;
+    unsigned m_segment = 0;
+    int m_fd = -1;
+    char *m_map = nullptr;
+    size_t m_mapSize = 0;
+    size_t m_pos = 0;
+};
+
+
+namespace detail{
+    /** @brief Anonymous memory aligned to align, a multiple of the page size, or nullptr. */
+    inline void * mapAligned(size_t length, size_t align){
+        // over-allocate and trim.
+        uint8_t *mapped = static_cast<uint8_t*>(mmap(nullptr, length + align, PROT_READ | PROT_WRITE,
+                                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if(mapped == MAP_FAILED){
+            return nullptr;
+        }
+        const size_t misalignment = reinterpret_cast<uintptr_t>(mapped) % align;
+        const size_t head = misalignment ? align - misalignment : 0;
+        if(head){
+            munmap(mapped, head);
+        }
+        munmap(mapped + head + length, align - head);
+        return mapped + head;
+    }
+
+    /** @brief Touch every page, so they're allocated now and not on first use. */
+    inline void prefault(void *memory, size_t length){
+        for(size_t i=0; i<length; i+=4096){
+            static_cast<volatile uint8_t*>(memory)[i] = 0;
+        }
+    }
+} // namespace detail
+
+
+/**
+ * @brief Allocator for LocalLogger<dynamic, dynamic> buffers backed by huge pages, to cut
+ * TLB misses on loggers with megabytes of buffers.
+ * \code{.cpp}
+ * static quicklog::HugePageAllocator hugePages;
+ * thread_local quicklog::LocalLogger<quicklog::dynamic, quicklog::dynamic> t_logger(16, 2 << 20, hugePages);
+ * \endcode
+ * 
+ * Each allocation is mapped separately, rounded up to whole pages of pageSize bytes, from
+ * the reserved huge pages (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages) if there are enough,
+ * otherwise as normal pages aligned to pageSize and marked MADV_HUGEPAGE for transparent
+ * huge pages. Either way they're populated up front, so log() doesn't take page faults.
+ */
+class HugePageAllocator{
+public:
+    /** @param pageSize The default huge page size. */
+    explicit HugePageAllocator(size_t pageSize = 2 << 20): m_pageSize(pageSize){}
+
+    void * allocate(size_t size, size_t align){
+        const size_t length = roundUp(size);
+        if(align > m_pageSize){
+            return nullptr;
+        }
+#ifdef MAP_HUGETLB
+        void *huge = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if(huge != MAP_FAILED){
+            return huge;
+        }
+#endif
+        uint8_t *memory = static_cast<uint8_t*>(detail::mapAligned(length, m_pageSize));
+        if(memory == nullptr){
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(memory, length, MADV_HUGEPAGE);
+#endif
+        detail::prefault(memory, length);
+        return memory;
+    }
+
+    void deallocate(void *memory, size_t size){
+        munmap(memory, roundUp(size));
+    }
+
+private:
+    size_t roundUp(size_t size) const{
+        return (size + m_pageSize - 1) / m_pageSize * m_pageSize;
+    }
+
+    size_t m_pageSize;
+};
+
+
+
+#ifdef __linux__
+/**
+ * @brief The NUMA node of the CPU the calling thread is running on, or 0 if that can't be
+ * found out. For LogServer::assignWorkers(), to give each node its own worker.
+ */
+inline size_t currentNumaNode(){
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) != 0){
+        return 0;
+    }
+    return node;
+}
+
+/**
+ * @brief Restrict the calling thread to the CPUs of a NUMA node, e.g. a LogServer worker
+ * to the node whose loggers it drains.
+ * \code{.cpp}
+ * g_server.assignWorkers(quicklog::currentNumaNode);
+ * for(size_t i=0; i<N_NODES; i++){
+ *     threads.emplace_back([i]{
+ *         quicklog::bindToNumaNode(i);
+ *         g_server.processWorker(g_server.worker(i));
+ *     });
+ * }
+ * \endcode
+ * 
+ * @return false if the node's CPUs couldn't be read from sysfs, or the affinity set.
+ */
+inline bool bindToNumaNode(size_t node){
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if(!file){
+        return false;
+    }
+    char list[4096];
+    const bool read = fgets(list, sizeof(list), file) != nullptr;
+    fclose(file);
+    if(!read){
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    bool any = false;
+    // e.g. 0-15,32-47
+    for(char *p=list; *p >= '0' && *p <= '9'; ){
+        const unsigned long first = strtoul(p, &p, 10);
+        const unsigned long last = *p == '-' ? strtoul(p + 1, &p, 10) : first;
+        for(unsigned long cpu=first; cpu<=last && cpu<CPU_SETSIZE; cpu++){
+            CPU_SET(cpu, &cpus);
+            any = true;
+        }
+        if(*p == ','){
+            ++p;
+        }
+    }
+    return any && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+/**
+ * @brief Allocator for LocalLogger<dynamic, dynamic> buffers on a NUMA node's memory,
+ * by default that of the thread constructing the logger, so producer writes and the
+ * reads of a worker on the same node stay node-local.
+ * \code{.cpp}
+ * static quicklog::NodeAllocator localMemory;
+ * thread_local quicklog::ScopedLocalLogger<decltype(g_server), quicklog::LocalLogger<quicklog::dynamic, quicklog::dynamic>>
+ *     t_logger(g_server, 16, 1 << 20, localMemory);
+ * \endcode
+ * 
+ * Memory is mapped aligned to pageSize, marked MADV_HUGEPAGE, bound to the node with
+ * MPOL_PREFERRED, so it comes from other nodes rather than failing when the node is full,
+ * and populated up front. Fixed-size loggers get the same placement from the kernel's
+ * first-touch policy if they're constructed by their own thread, e.g. thread_local.
+ */
+class NodeAllocator{
+public:
+    /** @param node The NUMA node, or -1 for that of the thread calling allocate(). */
+    explicit NodeAllocator(int node = -1, size_t pageSize = 2 << 20): m_node(node), m_pageSize(pageSize){}
+
+    void * allocate(size_t size, size_t align){
+        const size_t length = roundUp(size);
+        if(align > m_pageSize){
+            return nullptr;
+        }
+        void *memory = detail::mapAligned(length, m_pageSize);
+        if(memory == nullptr){
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(memory, length, MADV_HUGEPAGE);
+#endif
+        const size_t node = m_node < 0 ? currentNumaNode() : static_cast<size_t>(m_node);
+        unsigned long mask[maxNodes / (8 * sizeof(unsigned long))] = {};
+        if(node < maxNodes){
+            mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+            // maxnode is one more than the bits the kernel reads.
+            syscall(SYS_mbind, memory, length, MPOL_PREFERRED, mask, maxNodes + 1, 0);
+        }
+        detail::prefault(memory, length);
+        return memory;
+    }
+
+    void deallocate(void *memory, size_t size){
+        munmap(memory, roundUp(size));
+    }
+
+private:
+    static constexpr size_t maxNodes = 1024;
+
+    size_t roundUp(size_t size) const{
+        return (size + m_pageSize - 1) / m_pageSize * m_pageSize;
+    }
+
+    int m_node;
+    size_t m_pageSize;
+};
+
+
+/**
+ * @brief SpinYieldPark Parker using a futex on the word itself, so waking a parked
+ * thread is a single FUTEX_WAKE and parking is a single FUTEX_WAIT.
+ */
+class FutexParker{
+public:
+    void park(std::atomic<uint32_t> & word, uint32_t expected, uint64_t timeoutNs){
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32 bit word.");
+        timespec timeout;
+        timeout.tv_sec = static_cast<time_t>(timeoutNs / 1000000000);
+        timeout.tv_nsec = static_cast<long>(timeoutNs % 1000000000);
+        // returns straight away if word is no longer expected.
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &timeout, nullptr, 0);
+    }
+
+    void wake(std::atomic<uint32_t> & word){
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    void yield(){
+        sched_yield();
+    }
+};
+#endif
+
+
+/**
+ * @brief SpinYieldPark Parker using a pthread mutex and condition variable, for POSIX
+ * platforms without futexes.
+ */
+class CondParker{
+public:
+    CondParker(){
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+#ifndef __APPLE__
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+        pthread_cond_init(&m_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&m_mutex, nullptr);
+    }
+
+    ~CondParker(){
+        pthread_cond_destroy(&m_cond);
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    CondParker(const CondParker &) = delete;
+    CondParker & operator=(const CondParker &) = delete;
+
+    void park(std::atomic<uint32_t> & word, uint32_t expected, uint64_t timeoutNs){
+        timespec deadline;
+#ifdef __APPLE__
+        clock_gettime(CLOCK_REALTIME, &deadline);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+#endif
+        const uint64_t ns = deadline.tv_nsec + timeoutNs;
+        deadline.tv_sec += static_cast<time_t>(ns / 1000000000);
+        deadline.tv_nsec = static_cast<long>(ns % 1000000000);
+
+        pthread_mutex_lock(&m_mutex);
+        // wake() takes the mutex, so it can't change word between this check and the wait.
+        if(word.load(std::memory_order_relaxed) == expected){
+            pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    void wake(std::atomic<uint32_t> &){
+        pthread_mutex_lock(&m_mutex);
+        pthread_mutex_unlock(&m_mutex);
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    void yield(){
+        sched_yield();
+    }
+
+private:
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+};
+
+
+#ifdef __linux__
+typedef FutexParker DefaultParker;
+#else
+typedef CondParker DefaultParker;
+#endif
+
+/**
+ * @brief LogServer PlatformImpl that spins, yields, then parks on the platform's
+ * best Parker. See SpinYieldPark.
+ */
+typedef SpinYieldPark<DefaultParker> AdaptiveWait;
+
+
+/**
+ * @brief LogServer PlatformImpl that polls the loggers every periodNs nanoseconds and is
+ * never notified, so logging never makes a syscall. Entries wait up to periodNs before
+ * they're printed.
+ */
+template<uint64_t periodNs = 1000000>
+class TimedPoll{
+public:
+    void wait(){
+        timespec period;
+        period.tv_sec = static_cast<time_t>(periodNs / 1000000000);
+        period.tv_nsec = static_cast<long>(periodNs % 1000000000);
+        nanosleep(&period, nullptr);
+    }
+
+    void notify(){}
+};
+
+
+namespace detail{
+
+    template<class Server>
+    struct CrashHandler{
+        static Server * server;
+        static FdSink sink;
+
+        static void handle(int sig){
+            if(!server->crashDump(sink)){
+                // another thread is dumping, and will re-raise its signal once it's done.
+                while(true){
+                    pause();
+                }
+            }
+            signal(sig, SIG_DFL);
+            raise(sig);
+        }
+    };
+
+    template<class Server>
+    Server * CrashHandler<Server>::server = nullptr;
+
+    template<class Server>
+    FdSink CrashHandler<Server>::sink;
+
+} // namespace detail
+
+
+/**
+ * @brief Install signal handlers that write the server's unprinted entries to fd with
+ * LogServer::crashDump() when the process crashes, then let the signal take its default action.
+ * 
+ * fd should be opened up front, e.g. a file opened with O_APPEND. Render it with quicklog_decode.
+ * Only one LogServer per type can be installed.
+ * 
+ * @param signals The signals to handle, SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT by default.
+ */
+template<class Server>
+void installCrashHandler(Server & server, int fd,
+    std::initializer_list<int> signals = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT})
+{
+    detail::CrashHandler<Server>::server = &server;
+    detail::CrashHandler<Server>::sink.setFd(fd);
+    detail::CrashHandler<Server>::sink.setQuiet(true);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &detail::CrashHandler<Server>::handle;
+    sigemptyset(&action.sa_mask);
+    // run on the alternate stack if there is one, e.g. for stack overflows.
+    action.sa_flags = SA_ONSTACK;
+    for(int sig : signals){
+        sigaction(sig, &action, nullptr);
+    }
+}
+
+} // namespace quicklog
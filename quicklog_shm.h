@@ -0,0 +1,477 @@
+#pragma once
+
+/**
+ * @file quicklog_shm.h
+ *
+ * Logging from several processes into POSIX shared memory, drained by one
+ * quicklog_drain process.
+ *
+ * Each producer process creates a ShmRegion, a shared memory object holding a
+ * dictionary and a number of rings. Each ShmLogger claims one of the rings and writes
+ * the same records as RingLocalLogger into it, so logging still doesn't format or make
+ * calls. Records only hold decoder indices, which mean nothing outside the producer's
+ * own process, so each entry type's RecordLayout and SiteInfo are copied into the
+ * region's dictionary the first time it's logged. quicklog_drain reads the rings and
+ * the dictionary and writes the binary format, see binary.
+ *
+ * Strings can't be dereferenced by the drain either, so ShmLogger copies every
+ * <tt>const char*</tt> argument into the record like Str. Entries are cheapest logged
+ * via #QUICKLOG_SITE, which doesn't copy the format string.
+ *
+ */
+
+#include "quicklog.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace quicklog{
+
+namespace detail {
+
+    /**
+     * @brief The shared memory layout, as read by quicklog_drain.
+     *
+     * A region starts with a RegionHeader, followed by <tt>std::atomic<uint32_t></tt>
+     * dictionary offsets indexed by decoder, the dictionary, and numRings rings of a
+     * RingHeader followed by ringSize bytes of records, each at its own offset from the
+     * start of the region. Since records are only ever placed relative to a ring, which is
+     * aligned like the region, they are laid out the same in every process mapping it.
+     *
+     * Each dictionary entry is a <tt>uint8_t flags;</tt> and, if it has entryFlag, the
+     * RecordLayout as <tt>uint8_t placement; uint8_t payloadAlign; uint8_t numArgs;</tt>
+     * and numArgs <tt>uint16_t offset; uint8_t kind; uint8_t size; uint8_t storage;</tt>.
+     * If it has siteFlag, the SiteInfo follows as <tt>uint32_t line; uint8_t level; uint8_t
+     * numArgs;</tt>, numArgs pairs of <tt>uint8_t kind; uint8_t size;</tt> and the file and
+     * format as <tt>uint32_t length;</tt> followed by the characters, like binary.
+     */
+    namespace shm{
+        constexpr char magic[16] = "quicklog-shm   ";
+        constexpr uint32_t version = 1;
+        constexpr size_t lineSize = 64;
+
+        // dictionary entry flags.
+        constexpr uint8_t entryFlag = 1;
+        constexpr uint8_t siteFlag = 2;
+
+        enum RingState : uint32_t{
+            // not claimed by a ShmLogger.
+            ringFree,
+            ringUsed,
+            // the ShmLogger's gone, the drain frees the ring once it's read everything.
+            ringReleased
+        };
+
+        struct RegionHeader{
+            char magic[16];
+            uint32_t version;
+            uint32_t pid;
+            uint16_t headerSize;
+            uint16_t paddingDecoder;
+            uint32_t maxTypes;
+            uint32_t numRings;
+            uint32_t ringSize;
+            uint32_t dictSize;
+            uint32_t offsetsAt;
+            uint32_t dictAt;
+            uint32_t ringsAt;
+            uint32_t ringStride;
+            // dictionary bytes reserved so far.
+            std::atomic<uint32_t> dictEnd;
+            // set when the producer's ShmRegion is destroyed.
+            std::atomic<uint32_t> detached;
+        };
+
+        struct RingHeader{
+            alignas(lineSize) std::atomic<uint64_t> committed;
+            alignas(lineSize) std::atomic<uint64_t> readPos;
+            alignas(lineSize) std::atomic<uint32_t> state;
+        };
+
+        constexpr size_t roundUp(size_t n){
+            return (n + lineSize - 1) & ~(lineSize - 1);
+        }
+
+        template<typename T>
+        void put(uint8_t *& pos, const T & v){
+            memcpy(pos, &v, sizeof(v));
+            pos += sizeof(v);
+        }
+
+        inline void putString(uint8_t *& pos, const char *str){
+            const uint32_t length = str ? static_cast<uint32_t>(strlen(str)) : binary::nullString;
+            put(pos, length);
+            if(str){
+                memcpy(pos, str, length);
+                pos += length;
+            }
+        }
+
+        /** @brief The dictionary entry for a decoder, written to dest if it's not null. */
+        inline size_t dictEntry(uint8_t *dest, const RecordLayout *layout, const SiteInfo *site){
+            uint8_t *pos = dest;
+            size_t size = 1;
+            if(dest){
+                put(pos, static_cast<uint8_t>((layout ? entryFlag : 0) | (site ? siteFlag : 0)));
+            }
+            if(layout){
+                size += 3 + 5 * layout->numArgs;
+                if(dest){
+                    put(pos, static_cast<uint8_t>(layout->placement));
+                    put(pos, layout->payloadAlign);
+                    put(pos, layout->numArgs);
+                    for(size_t i=0; i<layout->numArgs; i++){
+                        put(pos, layout->args[i].offset);
+                        put(pos, layout->args[i].type.kind);
+                        put(pos, layout->args[i].type.size);
+                        put(pos, layout->args[i].storage);
+                    }
+                }
+            }
+            if(site){
+                size += 6 + 2 * site->numArgs + 8;
+                size += site->file ? strlen(site->file) : 0;
+                size += site->format ? strlen(site->format) : 0;
+                if(dest){
+                    put(pos, static_cast<uint32_t>(site->line));
+                    put(pos, site->level);
+                    put(pos, site->numArgs);
+                    for(size_t i=0; i<site->numArgs; i++){
+                        put(pos, site->argTypes[i].kind);
+                        put(pos, site->argTypes[i].size);
+                    }
+                    putString(pos, site->file);
+                    putString(pos, site->format);
+                }
+            }
+            return size;
+        }
+
+        /** @brief How ShmLogger passes an argument on: strings are copied. */
+        template<typename T>
+        const T & shareArg(const T & v){
+            return v;
+        }
+
+        inline Str shareArg(const char *s){
+            return str(s);
+        }
+
+        inline Str shareArg(char *s){
+            return str(s);
+        }
+    } // namespace shm
+
+}; // detail
+
+
+/**
+ * @brief A POSIX shared memory object that ShmLoggers in this process log into.
+ *
+ * Named "/quicklog.<pid>" unless given a name, so quicklog_drain can find it in
+ * /dev/shm. The drain unlinks it once the region's been destroyed and it has read
+ * everything, so it outlives the process that made it until then.
+ */
+class ShmRegion{
+public:
+    /**
+     * @param name Shared memory object name, starting with '/', or nullptr for "/quicklog.<pid>".
+     * A leftover "/quicklog.<pid>" is replaced, but a given name that already exists is an error.
+     * @param numRings The most ShmLoggers that can exist at once.
+     * @param ringSize The size of each ShmLogger's ring in bytes. A power of two.
+     * @param dictSize Room for the dictionary, in bytes.
+     */
+    explicit ShmRegion(const char *name = nullptr, uint32_t numRings = 16, uint32_t ringSize = 256 * 1024,
+                       uint32_t dictSize = 256 * 1024){
+        using namespace detail::shm;
+        if(ringSize < QUICKLOG_ALIGN || ringSize % lineSize || (ringSize & (ringSize - 1))){
+            QUICKLOG_ERROR("ShmRegion ringSize must be a power of two.\n");
+            return;
+        }
+        if(name){
+            snprintf(m_name, sizeof(m_name), "%s", name);
+        }else{
+            snprintf(m_name, sizeof(m_name), "/quicklog.%ld", static_cast<long>(getpid()));
+        }
+
+        const uint32_t maxTypes = QUICKLOG_MAX_ENTRY_TYPES;
+        const size_t offsetsAt = roundUp(sizeof(RegionHeader));
+        const size_t dictAt = roundUp(offsetsAt + maxTypes * sizeof(uint32_t));
+        const size_t ringsAt = roundUp(dictAt + dictSize);
+        const size_t ringStride = roundUp(sizeof(RingHeader)) + ringSize;
+        m_size = ringsAt + numRings * ringStride;
+        if(m_size > UINT32_MAX){
+            QUICKLOG_ERROR("ShmRegion too big.\n");
+            return;
+        }
+
+        if(!name){
+            // a leftover from an earlier process with the same pid is replaced. One the caller
+            // named may belong to a live process, so O_EXCL fails instead.
+            shm_unlink(m_name);
+        }
+        const int fd = shm_open(m_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd < 0){
+            QUICKLOG_ERROR("ShmRegion shm_open() failed.\n");
+            return;
+        }
+        void *base = MAP_FAILED;
+        if(ftruncate(fd, static_cast<off_t>(m_size)) == 0){
+            base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if(base == MAP_FAILED){
+            QUICKLOG_ERROR("ShmRegion mmap() failed.\n");
+            shm_unlink(m_name);
+            return;
+        }
+        m_base = static_cast<uint8_t*>(base);
+
+        // the object starts zeroed, so every ring is free and nothing's in the dictionary.
+        m_header = new (m_base) RegionHeader();
+        m_header->version = version;
+        m_header->pid = static_cast<uint32_t>(getpid());
+        m_header->headerSize = sizeof(RecordHeader) + timestampSize;
+        m_header->paddingDecoder = PaddingEntry::decoder();
+        m_header->maxTypes = maxTypes;
+        m_header->numRings = numRings;
+        m_header->ringSize = ringSize;
+        m_header->dictSize = dictSize;
+        m_header->offsetsAt = static_cast<uint32_t>(offsetsAt);
+        m_header->dictAt = static_cast<uint32_t>(dictAt);
+        m_header->ringsAt = static_cast<uint32_t>(ringsAt);
+        m_header->ringStride = static_cast<uint32_t>(ringStride);
+        m_offsets = reinterpret_cast<std::atomic<uint32_t>*>(m_base + offsetsAt);
+        for(uint32_t i=0; i<numRings; i++){
+            new (m_base + ringsAt + i * ringStride) RingHeader();
+        }
+        // the drain ignores the region until it sees the magic.
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(m_header->magic, magic, sizeof(magic));
+    }
+
+    ~ShmRegion(){
+        if(m_base){
+            m_header->detached.store(1, std::memory_order_release);
+            munmap(m_base, m_size);
+        }
+    }
+
+    ShmRegion(const ShmRegion &) = delete;
+    ShmRegion & operator=(const ShmRegion &) = delete;
+
+    /** @brief False if the region couldn't be created. */
+    bool ok() const{
+        return m_base != nullptr;
+    }
+
+    const char * name() const{
+        return m_name;
+    }
+
+private:
+    /**
+     * @brief Copy decoder id's layout and site into the dictionary, unless that's
+     * already been done by any thread.
+     */
+    bool publish(uint16_t id){
+        using namespace detail::shm;
+        if(id == DecoderTable::overflowId){
+            return false;
+        }
+        if(m_offsets[id].load(std::memory_order_acquire)){
+            return true;
+        }
+        const DecoderTable & decoders = decoderTable();
+        const size_t size = dictEntry(nullptr, decoders.layout(id), decoders.site(id));
+        const uint32_t offset = m_header->dictEnd.fetch_add(static_cast<uint32_t>(size), std::memory_order_relaxed);
+        if(offset + size > m_header->dictSize){
+            m_header->dictEnd.fetch_sub(static_cast<uint32_t>(size), std::memory_order_relaxed);
+            QUICKLOG_ERROR("ShmRegion dictionary full.\n");
+            return false;
+        }
+        dictEntry(m_base + m_header->dictAt + offset, decoders.layout(id), decoders.site(id));
+        // if another thread got there first this copy is just wasted.
+        uint32_t expected = 0;
+        m_offsets[id].compare_exchange_strong(expected, m_header->dictAt + offset, std::memory_order_release);
+        return true;
+    }
+
+    detail::shm::RingHeader * ring(uint32_t i){
+        return reinterpret_cast<detail::shm::RingHeader*>(m_base + m_header->ringsAt + i * m_header->ringStride);
+    }
+
+    /**
+     * @brief A ring no ShmLogger is using, now belonging to the caller, or nullptr if
+     * there isn't one. Rings the drain hasn't finished reading can be reused, their
+     * records are read in order whoever wrote them.
+     */
+    detail::shm::RingHeader * claimRing(){
+        for(uint32_t i=0; m_base && i<m_header->numRings; i++){
+            for(uint32_t state : {detail::shm::ringFree, detail::shm::ringReleased}){
+                uint32_t expected = state;
+                if(ring(i)->state.compare_exchange_strong(expected, detail::shm::ringUsed, std::memory_order_acquire)){
+                    return ring(i);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    char m_name[64] = {};
+    uint8_t *m_base = nullptr;
+    size_t m_size = 0;
+    detail::shm::RegionHeader *m_header = nullptr;
+    std::atomic<uint32_t> *m_offsets = nullptr;
+
+    template<class AlignPolicy, class OverflowPolicy>
+    friend class ShmLogger;
+};
+
+
+/**
+ * @brief Thread local logger writing into a ring of a ShmRegion, for quicklog_drain to
+ * print from another process. Used like RingLocalLogger, but without a LogServer.
+ *
+ * Claims one of the region's rings on construction and gives it back on destruction.
+ * If there wasn't a free ring, reports it via #QUICKLOG_ERROR and drops everything.
+ * The drain polls the rings, so nothing is ever notified.
+ *
+ * @tparam AlignPolicy How records are aligned in the ring. One of MaxAlign, FixedAlign or NaturalAlign.
+ * @tparam OverflowPolicy What \ref log() does when the ring is full. Spin, BoundedSpin, ErrorOnFull or DropNewest.
+ */
+template<class AlignPolicy = MaxAlign, class OverflowPolicy = DropNewest>
+class ShmLogger: public detail::LevelFilter,
+                 public detail::LoggerFrontEnd<ShmLogger<AlignPolicy, OverflowPolicy>, OverflowPolicy>
+{
+    static_assert(!std::is_same<OverflowPolicy, OverwriteOldest>::value, "ShmLogger doesn't support OverwriteOldest.");
+    static_assert(!std::is_same<OverflowPolicy, Block>::value, "ShmLogger has no LogServer to Block on.");
+
+public:
+    explicit ShmLogger(ShmRegion & region)
+        : m_region(region), m_ring(region.claimRing())
+    {
+        if(m_ring == nullptr){
+            QUICKLOG_ERROR("No free ShmRegion ring for ShmLogger.\n");
+            return;
+        }
+        m_data = reinterpret_cast<uint8_t*>(m_ring) + detail::shm::roundUp(sizeof(detail::shm::RingHeader));
+        m_ringSize = region.m_header->ringSize;
+        // carry on from wherever the ring's last owner stopped.
+        writePos = m_ring->committed.load(std::memory_order_relaxed);
+        cachedReadPos = m_ring->readPos.load(std::memory_order_acquire);
+    }
+
+    ~ShmLogger(){
+        if(m_ring){
+            flush();
+            m_ring->state.store(detail::shm::ringReleased, std::memory_order_release);
+        }
+    }
+
+    ShmLogger(const ShmLogger &) = delete;
+    ShmLogger & operator=(const ShmLogger &) = delete;
+
+    /**
+     * @brief Report any entries dropped by OverflowPolicy. Entries are available to the
+     * drain as soon as they're logged.
+     */
+    void flush(){
+        if(OverflowPolicy::drops && dropped){
+            this->reportDropped();
+        }
+    }
+
+private:
+    template <typename ...Ts>
+    bool push(const Ts & ... vs){
+        // the constructor reported there was no free ring.
+        if(m_ring == nullptr){
+            return false;
+        }
+        return pushShared(detail::shm::shareArg(vs) ...);
+    }
+
+    template <typename ...Ts>
+    bool pushShared(const Ts & ... vs){
+        while(!tryPush(vs ...)){
+            if(!OverflowPolicy::onFull(*this)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename ...Ts>
+    bool tryPush(const Ts & ... vs){
+        typedef LogEntry<AlignPolicy, Ts ...> Entry;
+        if(2 * Entry::maxSize > m_ringSize){
+            QUICKLOG_ERROR("Log entry too big for ShmRegion rings.\n");
+            return false;
+        }
+        if(!m_region.publish(Entry::decoder())){
+            return false;
+        }
+
+        const size_t pos = writePos & (m_ringSize - 1);
+        const size_t copied = Entry::copySize(vs ...);
+        size_t padding = 0;
+        size_t entryPos = pos;
+        size_t entrySize = Entry::size(pos, copied);
+        if(pos + entrySize > m_ringSize){
+            padding = m_ringSize - pos;
+            entryPos = 0;
+            entrySize = Entry::size(0, copied);
+        }
+
+        needed = padding + entrySize;
+        if(full()){
+            return false;
+        }
+
+        if(padding >= sizeof(RecordHeader)){
+            PaddingEntry::write(&m_data[pos], padding);
+        }
+        Entry::write(&m_data[entryPos], entryPos, entrySize, vs ...);
+
+        writePos += needed;
+        m_ring->committed.store(writePos, std::memory_order_release);
+        return true;
+    }
+
+    void countDrop(){}
+
+    void droppedReported(){}
+
+    /**
+     * @brief True if the entry tryPush() last attempted doesn't fit.
+     *
+     * Only rereads the drain's read position when the last one seen says it doesn't fit.
+     */
+    bool full(){
+        if(m_ringSize - (writePos - cachedReadPos) >= needed){
+            return false;
+        }
+        cachedReadPos = m_ring->readPos.load(std::memory_order_acquire);
+        return m_ringSize - (writePos - cachedReadPos) < needed;
+    }
+
+    ShmRegion & m_region;
+    detail::shm::RingHeader *m_ring;
+    uint8_t *m_data = nullptr;
+    size_t m_ringSize = 0;
+    uint64_t writePos = 0;
+    uint64_t cachedReadPos = 0;
+    size_t needed = 0;
+    unsigned long dropped = 0;
+
+    friend OverflowPolicy;
+    friend class detail::LoggerFrontEnd<ShmLogger, OverflowPolicy>;
+};
+
+} // namespace quicklog
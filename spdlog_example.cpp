@@ -1,5 +1,4 @@
 #include "quicklog.h"
-#include <mutex>
 #include <array>
 #include <time.h>
 
@@ -42,15 +41,7 @@ public:
     void notify(){
         sem_post(&m_semaphore);
     }
-    void lock(){
-        pthread_mutex_lock(&m_mutex);
-    }
-    void unlock(){
-        pthread_mutex_unlock(&m_mutex);
-
-    }
 private:
-    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
     sem_t m_semaphore;
 };
 
@@ -115,12 +106,12 @@ private:
 
 
 
-    std::array<LogProducer, 4>  producers{
-        LogProducer("a"),
-        LogProducer("b"),
-        LogProducer("c"),
-        LogProducer("d"),   
-    };
+    std::array<LogProducer, 4>  producers{{
+        {"a"},
+        {"b"},
+        {"c"},
+        {"d"},
+    }};
 
 
 int main(){